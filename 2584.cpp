@@ -11,20 +11,51 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <sstream>
+#include <vector>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistic.h"
+#include "pipeline.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "search.h"
+#include "metrics.h"
+#include "server.h"
+#include "interleave.h"
+#include "compare.h"
+#include "shard.h"
+#include "distill.h"
+#include "lockstep.h"
+#include "logfile.h"
 
 int main(int argc, const char* argv[]) {
-	std::cout << "2584-Demo: ";
-	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
-	std::cout << std::endl << std::endl;
-
 	size_t total = 1000, block = 0, limit = 0;
+	size_t actor = 0, learner = 1, queue = 64, width = 0, lanes = 0;
 	std::string play_args, evil_args;
 	std::string load, save;
+	std::vector<std::string> replay_logs;
+	std::string snapshot, resume;
+	size_t every = 0, delta = 0;
+	std::string candidates;
+	size_t rounds = 4, games = 100, group = 1, goal = 2584;
+	std::string sink, format = "json", prom, run;
+	size_t survey = 0;
+	std::string endpoint;
+	bool serve = false;
+	std::string detail;
+	bool instrument = false, counters = false;
+	std::vector<std::string> networks;
+	std::string shared;
+	std::string student_args;
+	bool quantize = false;
+	size_t workers = 1, worker = 0, sync = 1000;
+	double confidence = 0.95;
+	double minutes = 0;
+	size_t loaders = 0;
+	bool rebuild = true;
 	bool summary = false;
 	for (int i = 1; i < argc; i++) {
 		std::string para(argv[i]);
@@ -40,26 +71,201 @@ int main(int argc, const char* argv[]) {
 			evil_args = para.substr(para.find("=") + 1);
 		} else if (para.find("--load=") == 0) {
 			load = para.substr(para.find("=") + 1);
+		} else if (para.find("--load-threads=") == 0) {
+			loaders = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--skip-replay") == 0) {
+			rebuild = false;
 		} else if (para.find("--save=") == 0) {
 			save = para.substr(para.find("=") + 1);
+		} else if (para.find("--actor=") == 0) {
+			actor = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--learner=") == 0) {
+			learner = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--queue=") == 0) {
+			queue = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--interleave=") == 0) {
+			width = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--lockstep=") == 0) {
+			lanes = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--replay=") == 0) {
+			std::stringstream paths(para.substr(para.find("=") + 1));
+			for (std::string path; std::getline(paths, path, ','); ) replay_logs.push_back(path);
+		} else if (para.find("--checkpoint=") == 0) {
+			snapshot = para.substr(para.find("=") + 1);
+		} else if (para.find("--every=") == 0) {
+			every = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--minutes=") == 0) {
+			minutes = std::stod(para.substr(para.find("=") + 1));
+		} else if (para.find("--delta=") == 0) {
+			delta = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--resume=") == 0) {
+			resume = para.substr(para.find("=") + 1);
+		} else if (para.find("--search=") == 0) {
+			candidates = para.substr(para.find("=") + 1);
+		} else if (para.find("--rounds=") == 0) {
+			rounds = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--games=") == 0) {
+			games = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--group=") == 0) {
+			group = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--goal=") == 0) {
+			goal = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--metrics=") == 0) {
+			sink = para.substr(para.find("=") + 1);
+		} else if (para.find("--metrics-format=") == 0) {
+			format = para.substr(para.find("=") + 1);
+		} else if (para.find("--metrics-weights=") == 0) {
+			survey = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--prom=") == 0) {
+			prom = para.substr(para.find("=") + 1);
+		} else if (para.find("--run=") == 0) {
+			run = para.substr(para.find("=") + 1);
+		} else if (para.find("--serve") == 0) {
+			serve = true;
+			if (para.find("=") != std::string::npos) endpoint = para.substr(para.find("=") + 1);
+		} else if (para.find("--coverage") == 0) {
+			instrument = true;
+			if (para.find("=") != std::string::npos) detail = para.substr(para.find("=") + 1);
+		} else if (para.find("--compare=") == 0) {
+			std::stringstream paths(para.substr(para.find("=") + 1));
+			for (std::string path; std::getline(paths, path, ','); ) networks.push_back(path);
+		} else if (para.find("--confidence=") == 0) {
+			confidence = std::stod(para.substr(para.find("=") + 1));
+		} else if (para.find("--shard=") == 0) {
+			shared = para.substr(para.find("=") + 1);
+		} else if (para.find("--workers=") == 0) {
+			workers = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--worker=") == 0) {
+			worker = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--sync=") == 0) {
+			sync = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--distill=") == 0) {
+			student_args = para.substr(para.find("=") + 1);
+		} else if (para.find("--quantize") == 0) {
+			quantize = true;
+		} else if (para.find("--profile") == 0) {
+			profiler::enable();
+		} else if (para.find("--perf") == 0) {
+			counters = true;
 		} else if (para.find("--summary") == 0) {
 			summary = true;
 		}
 	}
 
+	std::ostream& info = (serve && endpoint.empty()) ? std::cerr : std::cout; // keep stdout for the replies
+	info << "2584-Demo: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(info, " "));
+	info << std::endl << std::endl;
+
+	if (counters) {
+		profiler::hardware(info);
+	}
+
+	if (serve) {
+		server(play_args).run(endpoint);
+		return 0;
+	}
+
+	if (candidates.size()) {
+		search(search::candidates(candidates, play_args), evil_args, total, rounds, games, group, goal).run(std::cout);
+		return 0;
+	}
+
+	if (networks.size() && block == 0) {
+		block = std::max(total / 10, size_t(1)); // the comparison looks at every block, 10 times by default
+	}
 	statistic stat(total, block, limit);
 
+	if (networks.size()) {
+		for (std::string& path : networks) path = play_args + " name=" + path.substr(path.find_last_of('/') + 1) + " load=" + path;
+		compare ab(networks, evil_args, confidence);
+		ab.run(stat);
+		stat.summary();
+		return 0;
+	}
+
 	if (load.size()) {
-		std::ifstream in(load, std::ios::in);
-		in >> stat;
-		in.close();
+		logfile log(load, loaders, rebuild);
+		log.load(stat);
+		log.report(info);
 		summary |= stat.is_finished();
 	}
 
-	player play(play_args);
+	if (student_args.size()) {
+		player teacher(play_args), student(student_args);
+		distill fit(teacher, student, evil_args, learner, quantize);
+		if (replay_logs.size()) fit.run(stat, replay_logs);
+		else fit.run(stat);
+		fit.evaluate(std::cout, games, goal);
+		return 0;
+	}
+
+	player play(play_args + (resume.size() ? " load=" + resume : ""));
 	rndenv evil(evil_args);
 
-	while (!stat.is_finished()) {
+	if (resume.size() && !checkpoint::resume(resume, play, evil, stat)) {
+		std::cerr << "cannot resume from " << resume << std::endl;
+		return -1;
+	}
+	checkpoint ckpt(snapshot, every, minutes, delta, stat.episodes());
+	if (snapshot.size()) {
+		stat.watch([&]() { ckpt.tick(play, evil, stat); });
+		stat.attach([&](std::ostream& out) { ckpt.report(out); });
+	}
+
+	shard peer(shared, workers, worker, sync);
+	if (shared.size()) {
+		if (delta) {
+			std::cerr << "delta checkpoints cannot be used with --shard" << std::endl;
+			return -1;
+		}
+		peer.start(play, stat);
+		stat.watch([&]() { peer.tick(play, stat); });
+		stat.attach([&](std::ostream& out) { peer.report(out); });
+	}
+
+	metrics exporter(sink, format, prom, run, survey);
+	if (sink.size() || prom.size()) {
+		stat.export_to([&](const statistic::record& r) { exporter.emit(r, play); });
+	}
+
+	if (width && play.sorted_updates()) {
+		std::cerr << "--interleave does not support update=sorted" << std::endl;
+		return -1;
+	}
+	if (lanes && play.learning_rate() != 0) {
+		std::cerr << "--lockstep evaluates without learning, and needs alpha=0" << std::endl;
+		return -1;
+	}
+	if (instrument && play.index_base() != 25) {
+		std::cerr << "--coverage needs the tables of base 25" << std::endl;
+		return -1;
+	}
+	std::unique_ptr<coverage> usage(instrument ? new coverage(play.tuple_set()) : nullptr);
+	if (usage) {
+		play.instrument(usage.get());
+		stat.attach([&](std::ostream& out) {
+			usage->report(out);
+			if (detail.size()) usage->dump(detail);
+		});
+	}
+
+	pipeline pipe(play, evil_args, actor, learner, queue);
+	if (replay_logs.size()) {
+		replay(play, replay_logs, learner).run(stat);
+	} else if (actor) {
+		pipe.run(stat);
+	}
+	interleave scheduler(play, evil, width);
+	if (width && replay_logs.empty() && !actor) {
+		scheduler.run(stat);
+	}
+	lockstep simulator(play, evil_args, lanes);
+	if (lanes && replay_logs.empty() && !actor && !width) {
+		simulator.run(stat);
+	}
+
+	while (!stat.is_finished() && replay_logs.empty()) {
 		play.open_episode("~:" + evil.name());
 		evil.open_episode(play.name() + ":~");
 
@@ -76,6 +282,7 @@ int main(int argc, const char* argv[]) {
 
 		play.close_episode(win.name());
 		evil.close_episode(win.name());
+		stat.settle_episode();
 	}
 
 	if (summary) {
@@ -9,38 +9,26 @@
 
 #pragma once
 #include <algorithm>
-#include <unordered_map>
 #include <string>
 #include "board.h"
 
+/**
+ * a trivially copyable action code, dispatched by its type flag
+ *
+ * the derived classes add no data, only constructors and accessors,
+ * so an action converts to and from them by value
+ */
 class action {
 public:
 	action(unsigned code = -1u) : code(code) {}
-	action(const action& a) : code(a.code) {}
-	virtual ~action() {}
 
 	class slide; // create a sliding action with board opcode
 	class place; // create a placing action with position and tile
 
 public:
-	virtual board::reward apply(board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
-	virtual std::ostream& operator >>(std::ostream& out) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
-		return out << "??";
-	}
-	virtual std::istream& operator <<(std::istream& in) {
-		auto state = in.rdstate();
-		for (auto proto = entries().begin(); proto != entries().end(); proto++) {
-			if (proto->second->reinterpret(this) << in) return in;
-			in.clear(state);
-		}
-		return in.ignore(2);
-	}
+	board::reward apply(board& b) const;
+	std::ostream& operator >>(std::ostream& out) const;
+	std::istream& operator <<(std::istream& in);
 
 public:
 	operator unsigned() const { return code; }
@@ -52,10 +40,6 @@ public:
 protected:
 	static constexpr unsigned type_flag(unsigned v) { return v << 24; }
 
-	typedef std::unordered_map<unsigned, action*> prototype;
-	static prototype& entries() { static prototype m; return m; }
-	virtual action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) action(*a); }
-
 	unsigned code;
 };
 
@@ -85,9 +69,6 @@ public:
 		in.setstate(std::ios::failbit);
 		return in;
 	}
-protected:
-	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) slide(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('s')] = new slide; }
 };
 
 class action::place : public action {
@@ -120,7 +101,42 @@ public:
 		in.setstate(std::ios::failbit);
 		return in;
 	}
-protected:
-	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
 };
+
+inline board::reward action::apply(board& b) const {
+	switch (type()) {
+	case slide::type: return slide(*this).apply(b);
+	case place::type: return place(*this).apply(b);
+	default:          return -1;
+	}
+}
+
+inline std::ostream& action::operator >>(std::ostream& out) const {
+	switch (type()) {
+	case slide::type: return slide(*this) >> out;
+	case place::type: return place(*this) >> out;
+	default:          return out << "??";
+	}
+}
+
+/**
+ * a sliding action is led by '#', and a placing action by its position
+ * skip 2 characters if neither format matches
+ */
+inline std::istream& action::operator <<(std::istream& in) {
+	auto state = in.rdstate();
+	action a;
+	if (in.peek() == '#') {
+		slide s;
+		if (s << in) a = s;
+	} else {
+		place p;
+		if (p << in) a = p;
+	}
+	if (in) {
+		code = a.code;
+		return in;
+	}
+	in.clear(state);
+	return in.ignore(2);
+}
@@ -17,7 +17,13 @@
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "weightio.h"
+#include "profiler.h"
+#include "coverage.h"
 #include <fstream>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 class agent {
 public:
@@ -63,6 +69,10 @@ public:
 	}
 	virtual ~random_agent() {}
 
+public:
+	friend std::ostream& operator <<(std::ostream& out, const random_agent& a) { return out << a.engine; }
+	friend std::istream& operator >>(std::istream& in, random_agent& a) { return in >> std::ws >> a.engine; }
+
 protected:
 	std::default_random_engine engine;
 };
@@ -72,24 +82,75 @@ protected:
  */
 class player : public agent {
 public:
-	player(const std::string& args = "") : agent("name=dummy role=player " + args), alpha(0) {
+	player(const std::string& args = "") : agent("name=dummy role=player " + args),
+		tuples(patterns()), alpha(0), sorted(false), online(false), base(25), pext(false), io(0), probe(nullptr) {
+		if (meta.find("tuple") != meta.end())
+			tuples = parse_patterns(meta["tuple"]);
+		features = make_features(tuples);
+		if (meta.find("layout") != meta.end() && std::string(meta["layout"]) == "pow2") {
+			if (meta.find("canonical") != meta.end() || (meta.find("update") != meta.end() && std::string(meta["update"]) == "sorted")) {
+				std::cerr << "layout=pow2 supports neither canonical nor update=sorted" << std::endl;
+				std::exit(-1);
+			}
+			base = 32;
+			features = make_packed(tuples, packing);
+			pext = fast_pext() && !(meta.find("extract") != meta.end() && std::string(meta["extract"]) == "table");
+		}
+		if (meta.find("canonical") != meta.end()) {
+			canonical merged = canonicalize(tuples);
+			merged.print(std::cerr, features.size());
+			tuples = merged.tuples;
+			features = merged.features;
+		}
+		if (meta.find("io") != meta.end())
+			io = int(meta["io"]);
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("update") != meta.end())
+			sorted = std::string(meta["update"]) == "sorted";
+		if (meta.find("update") != meta.end())
+			online = std::string(meta["update"]) == "online";
+		if (meta.find("steps") != meta.end())
+			recent.reset(std::max(int(meta["steps"]), 1));
+		touches = make_touches(features, base);
 	}
 	
 	virtual ~player() {
 		if (meta.find("save") != meta.end())
 			save_weights(meta["save"]);
 	}
+
+	struct step{
+		int reward ;
+		board after;
+	};
+	std::vector<step> history;
+
 	virtual action take_action(const board& before) {
+		step best;
+		int best_op = select_action(before, best);
+		if (best_op != -1 && online) {
+			observe(recent, best);
+		} else if (best_op != -1){
+			history.push_back(best);
+		}
+		return action::slide(best_op);
+	}
+
+	/**
+	 * select the move with the highest reward + afterstate value
+	 * return the opcode (or -1 if no move is legal) and store its reward and afterstate to 'best'
+	 */
+	int select_action(const board& before, step& best) const {
 		int best_op = -1;
 		int best_reward = -1;
 		float best_value = -std::numeric_limits<float>::max();
 		board best_after;
+		profiler::scope phase(profiler::slide); // estimate_value charges its own phases
 		for (int op:{0, 1, 2, 3}){
 			board after = before;
 			int reward = after.slide(op);
@@ -103,18 +164,83 @@ public:
 				best_after = after ;
 			}
 		}
-		if (best_op != -1){
-			history.push_back({best_reward, best_after});
-		}
-		return action::slide(best_op);
+		best = { best_reward, best_after };
+		return best_op;
 	}
 	virtual void open_episode(const std::string& flag = "") {
 		history.clear();
+		recent.reset();
 	}
 
 	virtual void close_episode(const std::string& flag = "") {
+		if (online) finish(recent);
+		else learn(history);
+	}
+
+	/**
+	 * the last afterstates of a game which are not updated yet, at most 'steps' of them,
+	 * so its memory does not grow with the game (see observe)
+	 */
+	class window {
+	public:
+		window(size_t steps = 1) { reset(steps); }
+		void reset(size_t steps) { ring.assign(steps, {}); reset(); }
+		void reset() { first = count = 0; }
+		size_t steps() const { return ring.size(); }
+		size_t size() const { return count; }
+		const step& operator [](size_t i) const { return ring[(first + i) % ring.size()]; }
+		void push(const step& s) { ring[(first + count++) % ring.size()] = s; }
+		void pop() { first = (first + 1) % ring.size(), count--; }
+	private:
+		std::vector<step> ring;
+		size_t first, count;
+	};
+	size_t online_steps() const { return online ? recent.steps() : 0; } // 0 for the backward pass
+	bool sorted_updates() const { return sorted; }
+
+	/**
+	 * the online n-step TD update, with 'update=online' and 'steps=n' (1 by default)
+	 *
+	 * the afterstates of a game are passed one by one as the game goes on; once n afterstates
+	 * follow the oldest one of the window, it is updated towards
+	 *   r(t+1) + ... + r(t+n) + V(s(t+n)),
+	 * so each move does one update, and only n steps are kept; with n = 1, this is TD(0) as in
+	 * learn, but forwards in time, so a target sees the updates of the earlier steps
+	 */
+	void observe(window& w, const step& s) {
+		if (alpha == 0) return;
+		if (w.size() == w.steps()) {
+			profiler::scope phase(profiler::update);
+			float target = estimate_value(s.after) + s.reward;
+			for (size_t i = 1; i < w.size(); i++) target += w[i].reward;
+			adjust_value(w[0].after, target);
+			w.pop();
+		}
+		w.push(s);
+	}
+
+	/**
+	 * update the afterstates left in the window at the end of a game, whose value is 0
+	 */
+	void finish(window& w) {
+		if (alpha == 0) return w.reset();
+		profiler::scope phase(profiler::update);
+		for (; w.size(); w.pop()) {
+			float target = 0;
+			for (size_t i = 1; i < w.size(); i++) target += w[i].reward;
+			adjust_value(w[0].after, target);
+		}
+	}
+
+	/**
+	 * the TD(0) backward pass over the afterstates of an episode
+	 * with 'update=sorted', the updates are batched (see learn_sorted)
+	 */
+	void learn(const std::vector<step>& history) {
 		if (history.empty())return;
 		if (alpha == 0 )return;
+		if (sorted) return learn_sorted(history);
+		profiler::scope phase(profiler::update);
 		adjust_value(history[history.size()- 1 ].after, 0);
 		for (int t = history.size() - 2 ; t>=0; t--) {
 			adjust_value(history[t].after,
@@ -124,472 +250,531 @@ public:
 
 	}
 
-	struct step{
-		int reward ;
-		board after;
+	/**
+	 * fit the afterstates of an episode to the values of a teacher, with the update of adjust_value
+	 * return the sum of the squared errors before the updates
+	 */
+	double fit(const std::vector<step>& history, const player& teacher) {
+		uint32_t index[max_features];
+		double square = 0;
+		for (const step& s : history) {
+			float target = teacher.estimate_value(s.after);
+			profiler::scope phase(profiler::feature);
+			extract_features(s.after, index);
+			phase.shift(profiler::lookup);
+			float error = target - lookup_value(index);
+			phase.shift(profiler::update);
+			add_value(index, alpha * error);
+			square += double(error) * error;
+		}
+		return square;
+	}
+
+	/**
+	 * the TD(0) backward pass with the weights before the episode
+	 *
+	 * the (table, index, delta) of all the updates are collected, sorted by a radix sort on
+	 * the key (table << 24 | index), merged, and applied in address order; unlike learn(),
+	 * the target of a step does not see the update of the next step
+	 */
+	void learn_sorted(const std::vector<step>& history) {
+		struct update { uint32_t key; float delta; };
+		static thread_local std::vector<update> batch, order;
+		uint32_t index[max_features];
+		profiler::scope phase(profiler::update);
+		batch.clear();
+		float next = 0;
+		for (size_t t = history.size(); t-- > 0; ) {
+			phase.shift(profiler::feature);
+			extract_features(history[t].after, index);
+			phase.shift(profiler::lookup);
+			float current = lookup_value(index);
+			phase.shift(profiler::update);
+			float target = t + 1 < history.size() ? history[t + 1].reward + next : 0;
+			float adjust = alpha * (target - current);
+			for (size_t i = 0; i < features.size(); i++) batch.push_back({ uint32_t(features[i].table) << 24 | index[i], adjust });
+			if (probe) {
+				probe->update(adjust);
+				for (size_t i = 0; i < features.size(); i++) probe->touch(features[i].table, index[i]);
+			}
+			next = current;
+		}
+
+		// three passes of 10-bit digits from the lower one, which cover the 29 bits of 24 tables
+		// the digit counts stay in L1, so each pass is a sequential read and 1024 write streams
+		order.resize(batch.size());
+		for (unsigned shift = 0; shift < 30; shift += 10) {
+			uint32_t offset[1 << 10] = {};
+			for (const update& u : batch) offset[(u.key >> shift) & 0x3ff]++;
+			for (uint32_t d = 0, sum = 0; d < (1 << 10); d++) std::swap(offset[d], sum), sum += offset[d];
+			for (const update& u : batch) order[offset[(u.key >> shift) & 0x3ff]++] = u;
+			std::swap(batch, order);
+		}
+		for (size_t i = 0; i < batch.size(); ) {
+			uint32_t key = batch[i].key;
+			float delta = 0;
+			for (; i < batch.size() && batch[i].key == key; i++) delta += batch[i].delta;
+			net[key >> 24].add(key & 0xffffff, delta);
+		}
+	}
+
+	/**
+	 * a feature is an n-tuple pattern viewed under one of the 8 board isomorphisms
+	 * its index is after(cell[0]) * base^(n-1) + after(cell[1]) * base^(n-2) + ... + after(cell[n-1]),
+	 * where the base is 25, or 32 with 'layout=pow2' (see make_packed)
+	 */
+	struct feature {
+		uint16_t table;
+		uint8_t length;
+		std::array<uint8_t, 5> cell;
 	};
-	std::vector<step> history;
+	static constexpr size_t max_features = 8 * 64;
 
-	int extract_feature(const board& after,int a ,int b, int c, int d, int e)const{
-		return after(a)*25*25*25*25 + after(b)*25*25*25 + after(c)*25*25 + after(d)*25+ after(e);
+	/**
+	 * the n-tuple patterns, each owns a weight table of 25^n entries
+	 */
+	static const std::vector<std::vector<unsigned>>& patterns() {
+		static const std::vector<std::vector<unsigned>> p = {
+			{ 0, 1, 2, 3, 4 }, { 0, 1, 2, 3, 5 }, { 0, 1, 2, 4, 5 }, { 0, 1, 2, 4, 8 },
+			{ 0, 1, 2, 5, 6 }, { 0, 1, 2, 5, 9 }, { 0, 1, 2, 6, 7 }, { 0, 1, 2, 6, 10 },
+			{ 0, 1, 4, 5, 6 }, { 0, 1, 5, 6, 7 }, { 0, 1, 5, 6, 10 }, { 0, 1, 5, 9, 13 },
+			{ 0, 1, 5, 9, 10 }, { 0, 1, 5, 8, 9 }, { 1, 2, 5, 6, 9 }, { 1, 2, 4, 5, 6 },
+			{ 1, 2, 5, 9, 10 }, { 1, 2, 5, 9, 13 }, { 1, 2, 5, 8, 9 }, { 1, 2, 4, 5, 9 },
+			{ 1, 4, 5, 6, 9 }, { 1, 4, 5, 6, 10 }, { 1, 4, 5, 6, 7 }, { 1, 5, 6, 9, 10 },
+		};
+		return p;
 	}
-	float estimate_value(const board& after) const{
+
+	/**
+	 * parse patterns from a spec like "0,1,2,3,4/4,5,6,7,8", where each pattern has at most 5 cells
+	 */
+	static std::vector<std::vector<unsigned>> parse_patterns(const std::string& spec) {
+		std::vector<std::vector<unsigned>> patterns;
+		std::stringstream list(spec);
+		for (std::string tuple; std::getline(list, tuple, '/'); ) {
+			std::vector<unsigned> cells;
+			std::stringstream ss(tuple);
+			for (std::string cell; std::getline(ss, cell, ','); ) cells.push_back(std::stoul(cell));
+			if (cells.empty() || cells.size() > 5 || *std::max_element(cells.begin(), cells.end()) > 15) {
+				std::cerr << "invalid tuple " << tuple << std::endl;
+				std::exit(-1);
+			}
+			patterns.push_back(cells);
+		}
+		if (patterns.empty() || patterns.size() * 8 > max_features) {
+			std::cerr << "invalid tuple set " << spec << std::endl;
+			std::exit(-1);
+		}
+		return patterns;
+	}
+
+	/**
+	 * the cell mapping of the 8 isomorphisms, in the order of
+	 * identity, 3 clockwise rotations, a horizontal reflection, and 3 more rotations
+	 */
+	static std::array<std::array<unsigned, 16>, 8> isomorphisms() {
+		std::array<std::array<unsigned, 16>, 8> iso;
+		board idx;
+		for (unsigned i = 0; i < 16; i++) idx(i) = i;
+		for (unsigned s = 0; s < 8; s++) {
+			if (s == 4) idx.reflect_horizontal();
+			else if (s != 0) idx.rotate_right();
+			for (unsigned i = 0; i < 16; i++) iso[s][i] = idx(i);
+		}
+		return iso;
+	}
+
+	static std::vector<feature> make_features(const std::vector<std::vector<unsigned>>& patterns) {
+		std::vector<feature> features;
+		auto iso = isomorphisms();
+		for (unsigned s = 0; s < 8; s++) {
+			for (unsigned t = 0; t < patterns.size(); t++) {
+				feature f = { uint16_t(t), uint8_t(patterns[t].size()), {} };
+				for (unsigned k = 0; k < f.length; k++) f.cell[k] = iso[s][patterns[t][k]];
+				features.push_back(f);
+			}
+		}
+		return features;
+	}
+
+	/**
+	 * the features of 'layout=pow2', whose tables have 32^n entries, so that an index is the
+	 * 5-bit tiles of the tuple side by side
+	 *
+	 * the board under isomorphism s is packed as two words of 8 cells, where cell c is at the
+	 * bits [5c, 5c + 5) of word c / 8; an index is then two _pext_u64 of the packed board by the
+	 * masks of the tuple, which take the cells in ascending order from the lowest bits, so the
+	 * cells of a feature are the tuple in descending order, mapped by the isomorphism
+	 */
+	struct packed {
+		uint64_t mask[2];
+		uint8_t shift; // the bits taken from word 0
+		uint8_t view; // the isomorphism
+	};
+	static std::vector<feature> make_packed(const std::vector<std::vector<unsigned>>& patterns, std::vector<packed>& packing) {
+		std::vector<feature> features;
+		packing.clear();
+		auto iso = isomorphisms();
+		for (unsigned s = 0; s < 8; s++) {
+			for (unsigned t = 0; t < patterns.size(); t++) {
+				std::vector<unsigned> order = patterns[t];
+				std::sort(order.rbegin(), order.rend());
+				feature f = { uint16_t(t), uint8_t(order.size()), {} };
+				packed p = { { 0, 0 }, 0, uint8_t(s) };
+				for (unsigned k = 0; k < f.length; k++) {
+					f.cell[k] = iso[s][order[k]];
+					p.mask[order[k] / 8] |= uint64_t(31) << (5 * (order[k] % 8));
+					p.shift += (order[k] < 8) * 5;
+				}
+				features.push_back(f);
+				packing.push_back(p);
+			}
+		}
+		return features;
+	}
+
+	/**
+	 * the features reading a cell, with the scale of the cell in their indices
+	 */
+	struct touch {
+		uint16_t feature;
+		uint32_t scale;
+	};
+	static std::array<std::vector<touch>, 16> make_touches(const std::vector<feature>& features, unsigned base) {
+		std::array<std::vector<touch>, 16> touches;
+		for (size_t i = 0; i < features.size(); i++) {
+			const feature& f = features[i];
+			uint32_t scale[16] = {};
+			for (unsigned k = 0, s = 1; k < f.length; k++, s *= base) scale[f.cell[f.length - 1 - k]] += s;
+			for (unsigned c = 0; c < 16; c++) {
+				if (scale[c]) touches[c].push_back({ uint16_t(i), scale[c] });
+			}
+		}
+		return touches;
+	}
+
+	/**
+	 * whether _pext_u64 is available and fast, i.e., not microcoded as on AMD before Zen 3
+	 */
+	static bool fast_pext() {
+#if defined(__x86_64__) && defined(__GNUC__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * a tuple set merged under the 8 isomorphisms
+	 *
+	 * tuples whose cell sets are images of each other are duplicates, and share the table of
+	 * the first one; a tuple mapped onto its own cell set by an isomorphism is self-symmetric,
+	 * and its features reading the same cell set are merged; so each table has one feature per
+	 * distinct image of its cell set, and its entry is the sum of the merged features, i.e.,
+	 *   merged(x) = sum of old[source.table](x with its digits in the order of the source)
+	 * which gives the same values as the old set with fewer tables and lookups
+	 */
+	struct canonical {
+		struct source {
+			unsigned table; // the old table
+			std::array<uint8_t, 5> order; // the positions in the new tuple of the old cells
+		};
+		std::vector<std::vector<unsigned>> tuples;
+		std::vector<feature> features;
+		std::vector<std::vector<source>> sources; // the old features merged into each table
+		size_t duplicates;
+		size_t symmetric;
+
+		/**
+		 * the format would be
+		 * canonical = 24 tuples, 24 tables (0 duplicates), 2 self-symmetric, 184 lookups (192 before)
+		 */
+		void print(std::ostream& out, size_t lookups) const {
+			out << "canonical = " << (tuples.size() + duplicates) << " tuples, " << tuples.size() << " tables (";
+			out << duplicates << " duplicates), " << symmetric << " self-symmetric, ";
+			out << features.size() << " lookups (" << lookups << " before)" << std::endl;
+		}
+	};
+
+	static canonical canonicalize(const std::vector<std::vector<unsigned>>& patterns) {
+		auto iso = isomorphisms();
+		auto image = [&](const std::vector<unsigned>& p, unsigned s) {
+			std::vector<unsigned> cells;
+			for (unsigned c : p) cells.push_back(iso[s][c]);
+			return cells;
+		};
+		auto sorted = [](std::vector<unsigned> cells) {
+			std::sort(cells.begin(), cells.end());
+			return cells;
+		};
+		canonical merged = {};
+		std::vector<unsigned> owner(patterns.size());
+		for (unsigned t = 0; t < patterns.size(); t++) {
+			owner[t] = merged.tuples.size();
+			for (unsigned r = 0; r < merged.tuples.size() && owner[t] == merged.tuples.size(); r++) {
+				for (unsigned s = 0; s < 8; s++) {
+					if (sorted(image(merged.tuples[r], s)) == sorted(patterns[t])) owner[t] = r;
+				}
+			}
+			if (owner[t] == merged.tuples.size()) merged.tuples.push_back(patterns[t]);
+			else merged.duplicates++;
+		}
+		merged.sources.resize(merged.tuples.size());
+		std::vector<std::vector<std::vector<unsigned>>> seen(merged.tuples.size());
+		for (unsigned s = 0; s < 8; s++) {
+			for (unsigned r = 0; r < merged.tuples.size(); r++) {
+				std::vector<unsigned> cells = image(merged.tuples[r], s), key = sorted(cells);
+				if (std::find(seen[r].begin(), seen[r].end(), key) != seen[r].end()) continue;
+				seen[r].push_back(key);
+				feature f = { uint16_t(r), uint8_t(cells.size()), {} };
+				for (unsigned k = 0; k < f.length && k < f.cell.size(); k++) f.cell[k] = cells[k];
+				merged.features.push_back(f);
+			}
+		}
+		for (unsigned r = 0; r < merged.tuples.size(); r++) {
+			if (seen[r].size() < 8) merged.symmetric++;
+			const std::vector<unsigned>& tuple = merged.tuples[r];
+			for (unsigned t = 0; t < patterns.size(); t++) {
+				if (owner[t] != r) continue;
+				for (unsigned s = 0; s < 8; s++) {
+					std::vector<unsigned> cells = image(patterns[t], s);
+					if (sorted(cells) != sorted(tuple)) continue;
+					canonical::source src = { t, {} };
+					for (size_t k = 0; k < cells.size() && k < src.order.size(); k++)
+						src.order[k] = std::find(tuple.begin(), tuple.end(), cells[k]) - tuple.begin();
+					merged.sources[r].push_back(src);
+				}
+			}
+		}
+		return merged;
+	}
+
+	/**
+	 * convert the tables of the old tuple set into those of the merged set
+	 * an old table is released once its new table is built, so at most one extra table is allocated
+	 */
+	static std::vector<weight> convert(std::vector<weight>& old, const canonical& merged) {
+		std::vector<weight> net;
+		for (size_t r = 0; r < merged.tuples.size(); r++) {
+			size_t length = merged.tuples[r].size();
+			weight w(size_t(std::pow(25, length)));
+			uint32_t scale[5];
+			for (size_t k = 0; k < length; k++) scale[k] = std::pow(25, length - 1 - k);
+			for (size_t x = 0; x < w.size(); x++) {
+				uint32_t digit[5];
+				for (size_t k = 0; k < length; k++) digit[k] = (x / scale[k]) % 25;
+				float value = 0;
+				for (const auto& src : merged.sources[r]) {
+					uint32_t index = 0;
+					for (size_t k = 0; k < length; k++) index += digit[src.order[k]] * scale[k];
+					value += static_cast<const weight&>(old[src.table])[index];
+				}
+				w[x] = value;
+			}
+			for (const auto& src : merged.sources[r]) old[src.table] = weight();
+			net.push_back(std::move(w));
+		}
+		return net;
+	}
+
+	void extract_features(const board& after, uint32_t* index) const {
+#if defined(__x86_64__) && defined(__GNUC__)
+		if (pext) return extract_packed(after, index);
+#endif
+		// scaled[d][c] = after(c) * base^d, so that an index is a plain sum of table reads
+		uint32_t scaled[5][16];
+		for (unsigned c = 0; c < 16; c++) scaled[0][c] = after(c);
+		for (unsigned d = 1; d < 5; d++)
+			for (unsigned c = 0; c < 16; c++) scaled[d][c] = scaled[d - 1][c] * base;
+		for (size_t i = 0, n = features.size(); i < n; i++) {
+			const feature& f = features[i];
+			const uint8_t* cell = f.cell.data();
+			if (f.length == 5) { // the common case, unrolled
+				index[i] = (scaled[4][cell[0]] + scaled[3][cell[1]]) + (scaled[2][cell[2]] + scaled[1][cell[3]]) + scaled[0][cell[4]];
+				continue;
+			}
+			index[i] = 0;
+			for (unsigned k = 0; k < f.length; k++) index[i] += scaled[f.length - 1 - k][cell[k]];
+		}
+	}
+#if defined(__x86_64__) && defined(__GNUC__)
+	__attribute__((target("bmi2")))
+	void extract_packed(const board& after, uint32_t* index) const {
+		static const auto iso = isomorphisms();
+		uint64_t word[8][2];
+		for (unsigned s = 0; s < 8; s++) {
+			word[s][0] = word[s][1] = 0;
+			for (unsigned c = 0; c < 16; c++) word[s][c / 8] |= uint64_t(after(iso[s][c])) << (5 * (c % 8));
+		}
+		const packed* p = packing.data();
+		for (size_t i = 0, n = packing.size(); i < n; i++) {
+			const uint64_t* w = word[p[i].view];
+			index[i] = _pext_u64(w[0], p[i].mask[0]) | (_pext_u64(w[1], p[i].mask[1]) << p[i].shift);
+		}
+	}
+#endif
+	float lookup_value(const uint32_t* index) const {
 		float value = 0;
-		board temp = after;
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right(); //轉第一次
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right();  //轉第二次
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right();  //轉第三次
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.reflect_horizontal(); //鏡像
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right();
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right();
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
-		temp.rotate_right();
-		value += net[0][extract_feature(temp, 0, 1, 2, 3, 4)];
-		value += net[1][extract_feature(temp, 0, 1, 2, 3, 5)];
-		value += net[2][extract_feature(temp, 0, 1, 2, 4, 5)];
-		value += net[3][extract_feature(temp, 0, 1, 2, 4, 8)];
-		value += net[4][extract_feature(temp, 0, 1, 2, 5, 6)];
-		value += net[5][extract_feature(temp, 0, 1, 2, 5, 9)];
-		value += net[6][extract_feature(temp, 0, 1, 2, 6, 7)];
-		value += net[7][extract_feature(temp, 0, 1, 2, 6, 10)];
-		value += net[8][extract_feature(temp, 0, 1, 4, 5, 6)];
-		value += net[9][extract_feature(temp, 0, 1, 5, 6, 7)];
-		value += net[10][extract_feature(temp, 0, 1, 5, 6, 10)];
-		value += net[11][extract_feature(temp, 0, 1, 5, 9, 13)];
-		value += net[12][extract_feature(temp, 0, 1, 5, 9, 10)];
-		value += net[13][extract_feature(temp, 0, 1, 5, 8, 9)];
-		value += net[14][extract_feature(temp, 1, 2, 5, 6, 9)];
-		value += net[15][extract_feature(temp, 1, 2, 4, 5, 6)];
-		value += net[16][extract_feature(temp, 1, 2, 5, 9, 10)];
-		value += net[17][extract_feature(temp, 1, 2, 5, 9, 13)];
-		value += net[18][extract_feature(temp, 1, 2, 5, 8, 9)];
-		value += net[19][extract_feature(temp, 1, 2, 4, 5, 9)];
-		value += net[20][extract_feature(temp, 1, 4, 5, 6, 9)];
-		value += net[21][extract_feature(temp, 1, 4, 5, 6, 10)];
-		value += net[22][extract_feature(temp, 1, 4, 5, 6, 7)];
-		value += net[23][extract_feature(temp, 1, 5, 6, 9, 10)];
+		const feature* f = features.data();
+		const weight* w = net.data();
+		for (size_t i = 0, n = features.size(); i < n; i++) value += w[f[i].table][index[i]];
+		return value;
+	}
+	float estimate_value(const board& after) const{
+		uint32_t index[max_features];
+		profiler::scope phase(profiler::feature);
+		extract_features(after, index);
+		phase.shift(profiler::lookup);
+		return lookup_value(index);
+	}
+
+	/**
+	 * evaluate a board as estimate_value, and keep its indices for place_value
+	 */
+	float estimate_value(const board& b, uint32_t* index) const {
+		profiler::scope phase(profiler::feature);
+		extract_features(b, index);
+		phase.shift(profiler::lookup);
+		return lookup_value(index);
+	}
+
+	/**
+	 * the value of board 'b' with 'tile' placed at 'pos', from the value and the indices of 'b'
+	 *
+	 * only the features reading the cell are looked up, whose indices change by
+	 * (tile - b(pos)) * base^(n-1-k) for the cell at position k; 'index' is kept, so all
+	 * the children of a chance node are evaluated from the same parent, e.g.,
+	 *   float v = play.estimate_value(after, index);
+	 *   for each empty cell p: play.place_value(after, v, index, p, 1) and (..., p, 2)
+	 * the result may differ from estimate_value by the float rounding, as the sum is in another order
+	 */
+	float place_value(const board& b, float value, const uint32_t* index, unsigned pos, board::cell tile) const {
+		profiler::scope phase(profiler::lookup);
+		uint32_t delta = tile - b(pos);
+		const weight* w = net.data();
+		for (const touch& t : touches[pos]) {
+			uint32_t i = index[t.feature];
+			const weight& table = w[features[t.feature].table];
+			value += table[i + delta * t.scale] - table[i];
+		}
 		return value;
 	}
+
 	void adjust_value(const board& after,float target){
-		float current = estimate_value(after);
+		uint32_t index[max_features];
+		profiler::scope phase(profiler::feature);
+		extract_features(after, index);
+		phase.shift(profiler::lookup);
+		float current = lookup_value(index);
+		phase.shift(profiler::update);
 		float error = target - current;
-		float adjust = alpha * error;
-		board temp = after;
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.reflect_horizontal();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
-		temp.rotate_right();
-		net[0][extract_feature(temp, 0, 1, 2, 3, 4)] += adjust;
-		net[1][extract_feature(temp, 0, 1, 2, 3, 5)] += adjust;
-		net[2][extract_feature(temp, 0, 1, 2, 4, 5)] += adjust;
-		net[3][extract_feature(temp, 0, 1, 2, 4, 8)] += adjust;
-		net[4][extract_feature(temp, 0, 1, 2, 5, 6)] += adjust;
-		net[5][extract_feature(temp, 0, 1, 2, 5, 9)] += adjust;
-		net[6][extract_feature(temp, 0, 1, 2, 6, 7)] += adjust;
-		net[7][extract_feature(temp, 0, 1, 2, 6, 10)] += adjust;
-		net[8][extract_feature(temp, 0, 1, 4, 5, 6)] += adjust;
-		net[9][extract_feature(temp, 0, 1, 5, 6, 7)] += adjust;
-		net[10][extract_feature(temp, 0, 1, 5, 6, 10)] += adjust;
-		net[11][extract_feature(temp, 0, 1, 5, 9, 13)] += adjust;
-		net[12][extract_feature(temp, 0, 1, 5, 9, 10)] += adjust;
-		net[13][extract_feature(temp, 0, 1, 5, 8, 9)] += adjust;
-		net[14][extract_feature(temp, 1, 2, 5, 6, 9)] += adjust;
-		net[15][extract_feature(temp, 1, 2, 4, 5, 6)] += adjust;
-		net[16][extract_feature(temp, 1, 2, 5, 9, 10)] += adjust;
-		net[17][extract_feature(temp, 1, 2, 5, 9, 13)] += adjust;
-		net[18][extract_feature(temp, 1, 2, 5, 8, 9)] += adjust;
-		net[19][extract_feature(temp, 1, 2, 4, 5, 9)] += adjust;
-		net[20][extract_feature(temp, 1, 4, 5, 6, 9)] += adjust;
-		net[21][extract_feature(temp, 1, 4, 5, 6, 10)] += adjust;
-		net[22][extract_feature(temp, 1, 4, 5, 6, 7)] += adjust;
-		net[23][extract_feature(temp, 1, 5, 6, 9, 10)] += adjust;
+		add_value(index, alpha * error);
+	}
+	void add_value(const uint32_t* index, float adjust) {
+		for (size_t i = 0; i < features.size(); i++) net[features[i].table].add(index[i], adjust);
+		if (probe) {
+			probe->update(adjust);
+			for (size_t i = 0; i < features.size(); i++) probe->touch(features[i].table, index[i]);
+		}
+	}
+
+	/**
+	 * hint the cache to fetch the entries of the given indices, e.g., before switching to another game
+	 */
+	void prefetch(const uint32_t* index) const {
+		const feature* f = features.data();
+		const weight* w = net.data();
+		for (size_t i = 0, n = features.size(); i < n; i++) __builtin_prefetch(&w[f[i].table][index[i]]);
 	}
+	const std::vector<weight>& weights() const { return net; }
+	std::vector<weight>& weights() { return net; }
+	float learning_rate() const { return alpha; }
+	const std::vector<std::vector<unsigned>>& tuple_set() const { return tuples; }
+	const std::vector<feature>& feature_set() const { return features; }
+	unsigned index_base() const { return base; }
+
+	/**
+	 * record the updates into 'c', or stop recording if 'c' is null
+	 */
+	void instrument(coverage* c) { probe = c; }
+
 protected:
 	virtual void init_weights(const std::string& info) {
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
-		net.emplace_back(25 * 25 * 25 * 25 * 25);
+		for (auto& p : tuples) net.emplace_back(size_t(std::pow(base, p.size())));
 	}
+	/**
+	 * the weight files are transferred in chunks by 'io' threads (all the cores by default),
+	 * and their checksums are verified if present, see weightio.h
+	 */
 	virtual void load_weights(const std::string& path) {
-		std::ifstream in(path, std::ios::in | std::ios::binary);
-		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
-		in.close();
+		weightio::reader in(path, io);
+		if (!in.good()) std::exit(-1);
+		net.resize(in.tables().size());
+		if (net.size() != tuples.size()) {
+			std::cerr << path << " has " << net.size() << " tables for " << tuples.size() << " tuples" << std::endl;
+			std::exit(-1);
+		}
+		for (size_t t = 0; t < net.size(); t++) {
+			if (in.get(t, net[t])) continue;
+			std::cerr << path << " is broken at table " << t << std::endl;
+			std::exit(-1);
+		}
+		for (size_t t = 0; base != 25 && t < net.size(); t++) { // a checkpoint keeps the layout of the tables
+			if (net[t].size() != size_t(std::pow(base, tuples[t].size()))) net[t] = repack(net[t], tuples[t], true);
+		}
 	}
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+		std::vector<size_t> sizes;
+		for (size_t t = 0; t < net.size(); t++) sizes.push_back(base == 25 ? net[t].size() : size_t(std::pow(25, tuples[t].size())));
+		weightio::writer out(path, sizes, io);
+		bool ok = true;
+		for (size_t t = 0; t < net.size(); t++) {
+			ok = ok && (base == 25 ? out.put(t, net[t]) : out.put(t, repack(net[t], tuples[t], false)));
+		}
+		if (!out.close() || !ok) {
+			std::cerr << "cannot write " << path << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * convert a table of a tuple between the file layout (base 25, see patterns) and that of
+	 * 'layout=pow2' (base 32, see make_packed); the entries with a digit of 25 or more are 0
+	 */
+	static weight repack(const weight& w, const std::vector<unsigned>& pattern, bool to_packed) {
+		size_t n = pattern.size(), size = std::pow(25, n);
+		if (w.size() != (to_packed ? size : size_t(1) << (5 * n))) {
+			std::cerr << "a table of " << w.size() << " entries is not of the tuple" << std::endl;
+			std::exit(-1);
+		}
+		std::vector<unsigned> shift(n);
+		for (size_t k = 0; k < n; k++) // the cells of lower positions are in the lower bits
+			shift[k] = 5 * std::count_if(pattern.begin(), pattern.end(), [&](unsigned c) { return c < pattern[k]; });
+		weight res(to_packed ? size_t(1) << (5 * n) : size);
+		for (size_t x = 0; x < size; x++) {
+			size_t y = 0;
+			for (size_t k = 0, v = x; k < n; k++, v /= 25) y |= (v % 25) << shift[n - 1 - k];
+			if (to_packed) res[y] = w[x];
+			else res[x] = w[y];
+		}
+		return res;
 	}
 
 protected:
+	std::vector<std::vector<unsigned>> tuples;
+	std::vector<feature> features;
 	std::vector<weight> net;
 	float alpha;
+	bool sorted; // batch the updates of an episode, see learn_sorted
+	bool online; // update during the game, see observe
+	window recent; // the window of take_action
+	unsigned base; // the base of the indices, 25 or 32
+	bool pext; // extract the indices of 'packing' by _pext_u64
+	size_t io; // the threads of the weight files, or 0 for all the cores
+	std::vector<packed> packing;
+	std::array<std::vector<touch>, 16> touches; // the features of each cell, see place_value
+	coverage* probe;
 };
 
 /**
@@ -604,6 +789,7 @@ public:
 		space({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }), popup(0, 9) {}
 
 	virtual action take_action(const board& after) {
+		profiler::scope phase(profiler::environment);
 		std::shuffle(space.begin(), space.end(), engine);
 		for (int pos : space) {
 			if (after(pos) != 0) continue;
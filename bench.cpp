@@ -0,0 +1,261 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * bench.cpp: Microbenchmarks for the hot paths of the framework
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cmath>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "profiler.h"
+
+/**
+ * a corpus of realistic mid-game boards
+ * the boards are sampled from the middle third of greedy games with a seeded environment
+ */
+std::vector<board> make_corpus(player& play, size_t size, unsigned seed) {
+	std::vector<board> corpus;
+	rndenv evil("seed=" + std::to_string(seed));
+	while (corpus.size() < size) {
+		episode game;
+		std::vector<board> states;
+		play.open_episode();
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+			states.push_back(game.state());
+		}
+		play.history.clear(); // not for learning
+		for (size_t i = states.size() / 3; i < states.size() * 2 / 3 && corpus.size() < size; i++)
+			corpus.push_back(states[i]);
+	}
+	return corpus;
+}
+
+/**
+ * the ns/op of each round of a benchmark
+ *
+ * the text format would be
+ * slide.up                        52.4 ns/op  (sd 1.2, min 51.0, 10 rounds x 10000 ops)
+ *
+ * the csv format would be
+ * name,mean,sd,min,rounds,ops
+ *
+ * the json format would be (one object per line)
+ * {"name":"slide.up","mean":52.4,"sd":1.2,"min":51.0,"rounds":10,"ops":10000}
+ */
+struct result {
+	std::string name;
+	std::vector<double> round;
+	size_t ops;
+
+	double mean() const { return std::accumulate(round.begin(), round.end(), 0.0) / round.size(); }
+	double sd() const {
+		double m = mean(), sq = 0;
+		for (double v : round) sq += (v - m) * (v - m);
+		return round.size() > 1 ? std::sqrt(sq / (round.size() - 1)) : 0;
+	}
+	double min() const { return *std::min_element(round.begin(), round.end()); }
+
+	void print(std::ostream& out, const std::string& format) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(1);
+		if (format == "csv") {
+			out << name << "," << mean() << "," << sd() << "," << min() << "," << round.size() << "," << ops;
+		} else if (format == "json") {
+			out << "{\"name\":\"" << name << "\",\"mean\":" << mean() << ",\"sd\":" << sd() << ",\"min\":" << min();
+			out << ",\"rounds\":" << round.size() << ",\"ops\":" << ops << "}";
+		} else {
+			out << std::left << std::setw(24) << name << std::right << std::setw(12) << mean() << " ns/op";
+			out << "  (sd " << sd() << ", min " << min() << ", " << round.size() << " rounds x " << ops << " ops)";
+		}
+		out << std::endl;
+		out.copyfmt(ff);
+	}
+};
+
+/**
+ * run 'kernel' for the given rounds, where each call of 'kernel' performs 'ops' operations
+ */
+result measure(const std::string& name, size_t rounds, size_t ops, const std::function<void()>& kernel) {
+	result res = { name, {}, ops };
+	kernel(); // warm up
+	for (size_t r = 0; r < rounds; r++) {
+		profiler::tick start = profiler::nanosec();
+		kernel();
+		res.round.push_back(double(profiler::nanosec() - start) / ops);
+	}
+	return res;
+}
+
+volatile long sink; // keep the results alive
+
+int main(int argc, const char* argv[]) {
+	size_t size = 10000, rounds = 10, games = 10;
+	unsigned seed = 0;
+	std::string play_args = "init", format = "text", filter;
+	for (int i = 1; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--corpus=") == 0) {
+			size = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--rounds=") == 0) {
+			rounds = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--games=") == 0) {
+			games = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--seed=") == 0) {
+			seed = std::stoul(para.substr(para.find("=") + 1));
+		} else if (para.find("--play=") == 0) {
+			play_args = para.substr(para.find("=") + 1);
+		} else if (para.find("--format=") == 0) {
+			format = para.substr(para.find("=") + 1);
+		} else if (para.find("--filter=") == 0) {
+			filter = para.substr(para.find("=") + 1);
+		}
+	}
+	if (format == "text") {
+		std::cout << "2584-Bench: ";
+		std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+		std::cout << std::endl << std::endl;
+	} else if (format == "csv") {
+		std::cout << "name,mean,sd,min,rounds,ops" << std::endl;
+	}
+
+	player play(play_args + " alpha=0");
+	std::vector<board> corpus = make_corpus(play, size, seed);
+	auto bench = [&](const std::string& name, size_t ops, const std::function<void()>& kernel) {
+		if (name.find(filter) != 0) return;
+		measure(name, rounds, ops, kernel).print(std::cout, format);
+	};
+
+	const char* dir[] = { "up", "right", "down", "left" };
+	for (unsigned op = 0; op < 4; op++) {
+		bench(std::string("slide.") + dir[op], corpus.size(), [&]() {
+			long sum = 0;
+			for (const board& b : corpus) sum += board(b).slide(op);
+			sink = sum;
+		});
+	}
+
+	typedef void (board::*symmetry)();
+	std::vector<std::pair<std::string, symmetry>> isomorphism = {
+		{ "transpose", &board::transpose },
+		{ "reflect_horizontal", &board::reflect_horizontal },
+		{ "reflect_vertical", &board::reflect_vertical },
+		{ "rotate_right", &board::rotate_right },
+		{ "rotate_left", &board::rotate_left },
+		{ "reverse", &board::reverse },
+	};
+	for (auto& iso : isomorphism) {
+		bench("board." + iso.first, corpus.size(), [&]() {
+			long sum = 0;
+			for (const board& b : corpus) {
+				board t = b;
+				(t.*iso.second)();
+				sum += t(0);
+			}
+			sink = sum;
+		});
+	}
+
+	bench("player.extract_features", corpus.size(), [&]() {
+		uint32_t index[player::max_features];
+		long sum = 0;
+		for (const board& b : corpus) {
+			play.extract_features(b, index);
+			sum += index[0];
+		}
+		sink = sum;
+	});
+	bench("player.estimate_value", corpus.size(), [&]() {
+		float sum = 0;
+		for (const board& b : corpus) sum += play.estimate_value(b);
+		sink = sum;
+	});
+
+	// the chance nodes of the afterstates of the corpus, each with 2 children per empty cell
+	std::vector<board> chance;
+	size_t children = 0;
+	for (const board& b : corpus) {
+		for (int op = 0; op < 4; op++) {
+			board after = b;
+			if (after.slide(op) == -1) continue;
+			chance.push_back(after);
+			for (unsigned c = 0; c < 16; c++) children += (after(c) == 0) * 2;
+			break;
+		}
+	}
+	bench("player.chance.full", children, [&]() {
+		float sum = 0;
+		for (const board& after : chance) {
+			for (unsigned c = 0; c < 16; c++) {
+				if (after(c) != 0) continue;
+				for (board::cell tile : { 1u, 2u }) {
+					board child = after;
+					child.place(c, tile);
+					sum += play.estimate_value(child);
+				}
+			}
+		}
+		sink = sum;
+	});
+	bench("player.chance.incremental", children, [&]() {
+		uint32_t index[player::max_features];
+		float sum = 0;
+		for (const board& after : chance) {
+			float value = play.estimate_value(after, index);
+			for (unsigned c = 0; c < 16; c++) {
+				if (after(c) != 0) continue;
+				for (board::cell tile : { 1u, 2u }) sum += play.place_value(after, value, index, c, tile);
+			}
+		}
+		sink = sum;
+	});
+	bench("player.adjust_value", corpus.size(), [&]() {
+		for (const board& b : corpus) play.adjust_value(b, 0); // alpha is 0, the weights stay intact
+	});
+	bench("player.take_action", corpus.size(), [&]() {
+		long sum = 0;
+		for (const board& b : corpus) sum += play.take_action(b);
+		play.history.clear();
+		sink = sum;
+	});
+
+	rndenv evil("seed=" + std::to_string(seed));
+	bench("rndenv.take_action", corpus.size(), [&]() {
+		long sum = 0;
+		for (const board& b : corpus) sum += evil.take_action(b);
+		sink = sum;
+	});
+
+	bench("episode", games, [&]() {
+		long sum = 0;
+		rndenv evil("seed=" + std::to_string(seed)); // the same games in every round
+		for (size_t i = 0; i < games; i++) {
+			episode game;
+			play.open_episode();
+			while (true) {
+				agent& who = game.take_turns(play, evil);
+				action move = who.take_action(game.state());
+				if (game.apply_action(move) != true) break;
+			}
+			sum += game.score();
+		}
+		play.history.clear();
+		sink = sum;
+	});
+
+	return 0;
+}
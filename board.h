@@ -53,6 +53,15 @@ public:
 		2584,4181,6765,10946,17711,28657,46368,75025,121393,196418,317811};
 		return fib[i];
 	}
+
+	/**
+	 * the tile of a Fibonacci value, e.g., 0 for an empty cell, 4 for 5, and 17 for 2584
+	 */
+	static int index(int value) {
+		int i = 0;
+		while (i < 27 && fibonacci(i) < value) i++;
+		return i;
+	}
 public:
 	bool operator ==(const board& b) const { return tile == b.tile; }
 	bool operator < (const board& b) const { return tile <  b.tile; }
@@ -189,7 +198,7 @@ public:
 		for (int i = 0; i < 16; i++) {
 			while (!std::isdigit(in.peek()) && in.good()) in.ignore(1);
 			in >> b(i);
-			b(i) = std::log2(b(i));
+			b(i) = index(b(i));
 		}
 		return in;
 	}
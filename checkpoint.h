@@ -0,0 +1,315 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * checkpoint.h: Non-blocking periodic snapshots of a training run
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "agent.h"
+#include "weight.h"
+#include "statistic.h"
+#include "profiler.h"
+
+/**
+ * snapshots of the weights, the environment engine and the episode counter
+ *
+ * a snapshot is taken by fork(), so the child holds a copy-on-write image of the tables
+ * at that moment and writes it while the parent keeps training; the file is written to
+ * 'path.tmp' and renamed to 'path' when complete, so 'path' is always a whole snapshot
+ *
+ * the file is a regular weight file (loadable by 'load=path') followed by a trailer
+ * "ckpt" | uint64 length | "<episode count> <serial>\n<environment engine>\n"
+ *
+ * with 'delta', only every delta-th snapshot is full, and the others are written to
+ * 'path.1', 'path.2', ... with the blocks changed since the previous snapshot
+ * "wdlt" | uint64 serial | uint64 sequence | uint32 tables, then for each table
+ * uint64 size | uint64 runs | runs x (uint64 first block | uint64 blocks | values),
+ * followed by the same trailer; the serial identifies the full snapshot of the chain
+ */
+class checkpoint {
+public:
+	/**
+	 * 'start' is the episode counter the run begins with, e.g., the one restored by resume
+	 */
+	checkpoint(const std::string& path, size_t every = 0, double minutes = 0, size_t delta = 0, size_t start = 0)
+		: path(path), every(every), minutes(minutes), delta(delta), last_count(start), last_time(profiler::nanosec()),
+		  serial(0), sequence(0), busy(false), broken(true), saved(0), skipped(0), failed(0), elapsed(0), written(0) {}
+	~checkpoint() {
+		if (writer.joinable()) writer.join();
+	}
+
+	/**
+	 * take a snapshot if 'every' episodes or 'minutes' have passed since the last one
+	 */
+	void tick(player& play, const random_agent& evil, const statistic& stat) {
+		bool due = (every && stat.count - last_count >= every);
+		due |= (minutes > 0 && (profiler::nanosec() - last_time) >= minutes * 60e9);
+		if (due) save(play, evil, stat);
+	}
+
+	/**
+	 * start writing a snapshot in the background, unless the previous one is still being written
+	 * the snapshot is full if it is the delta-th one, or if the chain is broken by a failure
+	 */
+	void save(player& play, const random_agent& evil, const statistic& stat) {
+		last_count = stat.count;
+		last_time = profiler::nanosec();
+		if (busy) {
+			skipped++;
+			return;
+		}
+		if (writer.joinable()) writer.join();
+
+		std::vector<std::vector<uint64_t>> runs; // built here, since the child must not allocate
+		for (weight& w : play.weights()) runs.push_back(checkpoint::runs(w.collect()));
+		bool full = !delta || broken || sequence + 1 >= delta;
+		if (full) {
+			serial = (uint64_t(std::random_device()()) << 32) ^ profiler::nanosec();
+			sequence = 0;
+		} else {
+			sequence++;
+		}
+		std::stringstream state;
+		state << stat.count << " " << serial << std::endl << evil << std::endl;
+		std::string trailer = state.str();
+		std::string target = full ? path : path + "." + std::to_string(sequence);
+		std::string temp = target + ".tmp";
+		uint64_t serial = this->serial, sequence = this->sequence;
+		auto write = [=, &play]() -> bool {
+			const std::vector<weight>& net = play.weights();
+			bool ok = full ? checkpoint::write(temp, net, trailer)
+			               : checkpoint::write(temp, net, runs, serial, sequence, trailer);
+			return ok && std::rename(temp.c_str(), target.c_str()) == 0;
+		};
+		profiler::tick start = profiler::nanosec();
+		busy = true;
+		pid_t pid = fork();
+		if (pid == 0) { // the child has a frozen copy of the tables, and must not return
+			_exit(write() ? 0 : 1);
+		}
+		writer = std::thread([this, pid, start, target, full, write]() {
+			bool ok;
+			if (pid > 0) {
+				int status = 0;
+				ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			} else { // fork is unavailable, fall back to writing the live tables
+				ok = write();
+			}
+			for (size_t i = 1; ok && full && ::unlink((path + "." + std::to_string(i)).c_str()) == 0; i++);
+			struct stat info;
+			if (ok && ::stat(target.c_str(), &info) == 0) written = info.st_size;
+			(ok ? saved : failed)++;
+			broken = !ok; // the changes of a failed snapshot are lost from the chain
+			elapsed = profiler::nanosec() - start;
+			busy = false;
+		});
+	}
+
+	/**
+	 * restore the environment engine and the episode counter from a snapshot,
+	 * and apply the chain of deltas 'path.1', 'path.2', ... of the same serial to the weights
+	 * the full weights should be loaded by the player itself, e.g., with 'load=path'
+	 */
+	static bool resume(const std::string& path, player& play, random_agent& evil, statistic& stat) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		uint32_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		for (uint32_t i = 0; i < size; i++) {
+			uint64_t len = 0;
+			in.read(reinterpret_cast<char*>(&len), sizeof(len));
+			in.seekg(len * sizeof(weight::type), std::ios::cur);
+		}
+		std::string trailer;
+		if (!read_trailer(in, trailer)) return false;
+		size_t count = 0;
+		uint64_t serial = 0;
+		std::stringstream(trailer) >> count >> serial;
+		for (uint64_t seq = 1; patch(path + "." + std::to_string(seq), play.weights(), serial, seq, trailer); seq++);
+
+		std::stringstream state(trailer);
+		state >> count >> serial >> evil;
+		if (!state) return false;
+		stat.count = count;
+		stat.total = std::max(stat.total, count);
+		return true;
+	}
+
+	/**
+	 * apply a delta file to the tables if it is the given link of the chain
+	 * the trailer of the delta is stored into 'trailer'
+	 */
+	static bool patch(const std::string& file, std::vector<weight>& net, uint64_t serial, uint64_t sequence, std::string& trailer) {
+		std::ifstream in(file, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		char magic[4] = {};
+		uint64_t head[2] = {};
+		uint32_t size = 0;
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(head), sizeof(head));
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		if (!in || std::string(magic, 4) != "wdlt" || head[0] != serial || head[1] != sequence) return false;
+		if (size != net.size()) return false;
+		for (weight& w : net) {
+			uint64_t len = 0, runs = 0;
+			in.read(reinterpret_cast<char*>(&len), sizeof(len));
+			in.read(reinterpret_cast<char*>(&runs), sizeof(runs));
+			if (!in || len != w.size()) return false;
+			for (uint64_t r = 0; r < runs; r++) {
+				uint64_t run[2] = {};
+				in.read(reinterpret_cast<char*>(run), sizeof(run));
+				size_t first = run[0] * weight::block, last = std::min((run[0] + run[1]) * weight::block, len);
+				if (!in || first >= last) return false;
+				in.read(reinterpret_cast<char*>(&w[first]), (last - first) * sizeof(weight::type));
+			}
+		}
+		return read_trailer(in, trailer);
+	}
+
+	static bool read_trailer(std::istream& in, std::string& trailer) {
+		char magic[4] = {};
+		uint64_t len = 0;
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(&len), sizeof(len));
+		if (!in || std::string(magic, 4) != "ckpt") return false;
+		trailer.assign(len, '\0');
+		in.read(&trailer[0], len);
+		return bool(in);
+	}
+
+	/**
+	 * write the tables and the trailer with plain system calls, which is safe in a forked child
+	 */
+	static bool write(const std::string& temp, const std::vector<weight>& net, const std::string& trailer) {
+		int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return false;
+		uint32_t size = net.size();
+		bool ok = write(fd, &size, sizeof(size));
+		for (const weight& w : net) {
+			uint64_t len = w.size();
+			ok = ok && write(fd, &len, sizeof(len));
+			ok = ok && (len == 0 || write(fd, &w[0], len * sizeof(weight::type)));
+		}
+		ok = ok && write_trailer(fd, trailer);
+		ok = ok && ::fsync(fd) == 0;
+		return ::close(fd) == 0 && ok;
+	}
+
+	/**
+	 * write the marked blocks of the tables as a delta, where adjacent blocks are merged into runs
+	 */
+	static bool write(const std::string& temp, const std::vector<weight>& net, const std::vector<std::vector<uint8_t>>& marks,
+			uint64_t serial, uint64_t sequence, const std::string& trailer) {
+		std::vector<std::vector<uint64_t>> runs;
+		for (const std::vector<uint8_t>& mark : marks) runs.push_back(checkpoint::runs(mark));
+		return write(temp, net, runs, serial, sequence, trailer);
+	}
+
+	/**
+	 * the runs of the marked blocks, as pairs of (first block, blocks)
+	 */
+	static std::vector<uint64_t> runs(const std::vector<uint8_t>& mark) {
+		std::vector<uint64_t> runs;
+		for (size_t b = 0; b < mark.size(); b++) {
+			if (!mark[b]) continue;
+			if (runs.size() && runs[runs.size() - 2] + runs.back() == b) runs.back()++;
+			else runs.insert(runs.end(), { b, 1 });
+		}
+		return runs;
+	}
+
+	/**
+	 * write the given runs of blocks of the tables as a delta, with plain system calls as above
+	 */
+	static bool write(const std::string& temp, const std::vector<weight>& net, const std::vector<std::vector<uint64_t>>& blocks,
+			uint64_t serial, uint64_t sequence, const std::string& trailer) {
+		int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return false;
+		uint64_t head[2] = { serial, sequence };
+		uint32_t size = net.size();
+		bool ok = write(fd, "wdlt", 4) && write(fd, head, sizeof(head)) && write(fd, &size, sizeof(size));
+		for (size_t t = 0; t < net.size(); t++) {
+			const weight& w = net[t];
+			const std::vector<uint64_t>& runs = blocks[t];
+			uint64_t len = w.size(), count = runs.size() / 2;
+			ok = ok && write(fd, &len, sizeof(len)) && write(fd, &count, sizeof(count));
+			for (size_t r = 0; r < runs.size(); r += 2) {
+				size_t first = runs[r] * weight::block, last = std::min((runs[r] + runs[r + 1]) * weight::block, w.size());
+				ok = ok && write(fd, &runs[r], 2 * sizeof(uint64_t));
+				ok = ok && write(fd, &w[first], (last - first) * sizeof(weight::type));
+			}
+		}
+		ok = ok && write_trailer(fd, trailer);
+		ok = ok && ::fsync(fd) == 0;
+		return ::close(fd) == 0 && ok;
+	}
+
+	/**
+	 * the format would be
+	 * checkpoint = 12 saved, 1 skipped, 0 failed, last 3.2s 18.5MB (delta 3)
+	 *
+	 * where 'skipped' is the snapshots not taken since the previous one was still being written,
+	 * 'last' is the time between the fork and the rename of the latest snapshot and its size,
+	 * and 'delta' is its position in the chain after the full snapshot (0 for a full one)
+	 */
+	void report(std::ostream& out) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "checkpoint = " << saved << " saved, " << skipped << " skipped, " << failed << " failed";
+		out << ", last " << std::fixed << std::setprecision(1) << (elapsed * 1e-9) << "s " << (written * 1e-6) << "MB";
+		out << " (delta " << sequence << ")" << std::endl;
+		out.copyfmt(ff);
+	}
+
+protected:
+	static bool write_trailer(int fd, const std::string& trailer) {
+		uint64_t len = trailer.size();
+		return write(fd, "ckpt", 4) && write(fd, &len, sizeof(len)) && write(fd, trailer.data(), len);
+	}
+	static bool write(int fd, const void* data, size_t size) {
+		const char* buf = static_cast<const char*>(data);
+		while (size) {
+			ssize_t n = ::write(fd, buf, size);
+			if (n <= 0) return false;
+			buf += n;
+			size -= n;
+		}
+		return true;
+	}
+
+private:
+	std::string path;
+	size_t every;
+	double minutes;
+	size_t delta;
+	size_t last_count;
+	profiler::tick last_time;
+	uint64_t serial;
+	uint64_t sequence;
+
+	std::thread writer;
+	std::atomic<bool> busy;
+	std::atomic<bool> broken;
+	std::atomic<size_t> saved;
+	std::atomic<size_t> skipped;
+	std::atomic<size_t> failed;
+	std::atomic<profiler::tick> elapsed;
+	std::atomic<size_t> written;
+};
@@ -0,0 +1,197 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * compare.h: A/B evaluation with common random numbers and sequential stopping
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <thread>
+#include <memory>
+#include <random>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+
+/**
+ * evaluate several networks without learning, and compare each of them with the first one
+ *
+ * the i-th game of every network uses an environment with the same seed, so the scores are
+ * compared in pairs, and the variance of their differences is usually much smaller than that
+ * of two independent runs; after every block of games, each difference is tested, and the
+ * evaluation stops once all of them are significant, so the block should be a fraction of the
+ * total (a tenth by default with '--compare')
+ *
+ * the tests are two-sided at the level 1 - confidence, which is split evenly among the pairs,
+ * and spent over the blocks with the O'Brien-Fleming type function of Lan and DeMets,
+ *   spent(t) = 2 - 2 Phi(z(1 - a/2) / sqrt(t)), where t = games / total,
+ * i.e., a block rejects if |z| exceeds the bound of the alpha spent since the last block;
+ * the intervals are difference +- bound * standard error, which cover all the blocks at once
+ */
+class compare {
+public:
+	compare(const std::vector<std::string>& networks, const std::string& evil_args, double confidence = 0.95)
+		: confidence(std::min(std::max(confidence, 0.5), 0.999999)), seed(std::random_device()()), bound(0), spent(0) {
+		std::stringstream ss(evil_args);
+		for (std::string pair; ss >> pair; ) {
+			if (pair.find("seed=") == 0) seed = std::stoul(pair.substr(5));
+		}
+		for (const std::string& args : networks) entries.emplace_back(new network(args));
+		if (entries.size() < 2) {
+			std::cerr << "at least two networks are required" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * play the blocks of 'stat' until all the differences are significant or all the games are played
+	 * the episodes of the first network are recorded in 'stat', and the report is attached to it
+	 */
+	void run(statistic& stat) {
+		stat.attach([this](std::ostream& out) { report(out); });
+		size_t total = stat.remaining(), played = 0;
+		while (played < total) {
+			size_t count = std::min(stat.block_size() - stat.episodes() % stat.block_size(), total - played);
+			std::vector<std::thread> threads;
+			for (auto& n : entries) threads.emplace_back(&compare::evaluate, this, n.get(), played, count);
+			for (std::thread& t : threads) t.join();
+			played += count;
+			look(double(played) / total);
+			for (episode& ep : entries[0]->games) stat.push(ep); // the block is shown after the last one
+			if (decided()) {
+				stat.stop();
+				break;
+			}
+		}
+	}
+
+	/**
+	 * the format would be
+	 * compare = 3000 games, bound 2.81 (alpha 0.0500, spent 0.0061)
+	 *         b.bin - a.bin = +1520 (95% CI +830 .. +2210), a.bin 52342, b.bin 53862, z 4.31, decided
+	 *
+	 * where 'bound' is the |z| to reject at the last block, 'spent' is the alpha spent so far,
+	 * and 'CI' is the repeated confidence interval of the paired difference of the average scores
+	 */
+	void report(std::ostream& out) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(0);
+		out << "\t" "compare = " << entries[0]->score.size() << " games, bound " << std::setprecision(2) << bound;
+		out << " (alpha " << std::setprecision(4) << (1 - confidence) << ", spent " << spent << ")" << std::endl;
+		for (size_t k = 1; k < entries.size(); k++) {
+			double mean = difference(k), width = bound * error(k);
+			out << "\t" << entries[k]->name << " - " << entries[0]->name << " = " << std::showpos << std::setprecision(0) << mean;
+			out << " (" << std::noshowpos << (confidence * 100) << "% CI " << std::showpos << (mean - width) << " .. " << (mean + width) << ")";
+			out << std::noshowpos << ", " << entries[0]->name << " " << entries[0]->mean() << ", " << entries[k]->name << " " << entries[k]->mean();
+			out << ", z " << std::setprecision(2) << z(k) << (significant(k) ? ", decided" : "") << std::endl;
+		}
+		out.copyfmt(ff);
+	}
+
+protected:
+	struct network {
+		std::string name;
+		player play;
+		std::vector<board::reward> score;
+		std::vector<episode> games; // the games of the last block
+		network(const std::string& args) : play(args) {
+			name = play.name();
+		}
+		double mean() const {
+			return score.size() ? std::accumulate(score.begin(), score.end(), 0.0) / score.size() : 0;
+		}
+	};
+
+	/**
+	 * play the games [first, first + count) of a network, each with the environment of its own seed
+	 */
+	void evaluate(network* n, size_t first, size_t count) {
+		n->games.assign(count, episode());
+		for (size_t i = 0; i < count; i++) {
+			rndenv evil("seed=" + std::to_string(seed + first + i));
+			episode& game = n->games[i];
+			game.open_episode(n->name + ":" + evil.name());
+			while (true) {
+				agent& who = game.take_turns(n->play, evil);
+				action move;
+				if (&who == &n->play) {
+					player::step best;
+					move = action::slide(n->play.select_action(game.state(), best));
+				} else {
+					move = who.take_action(game.state());
+				}
+				if (game.apply_action(move) != true) break;
+			}
+			agent& win = game.last_turns(n->play, evil);
+			game.close_episode(win.name());
+			n->score.push_back(game.score());
+		}
+	}
+
+	/**
+	 * update the bound with the alpha to spend at the information fraction t
+	 */
+	void look(double t) {
+		double alpha = (1 - confidence) / (entries.size() - 1);
+		double target = 2 - 2 * phi(quantile(1 - alpha / 2) / std::sqrt(std::max(t, 1e-9)));
+		double step = std::max(std::min(target, alpha) - spent, 1e-12);
+		bound = quantile(1 - step / 2);
+		spent = std::min(target, alpha);
+	}
+
+	double difference(size_t k) const {
+		return entries[k]->mean() - entries[0]->mean();
+	}
+	double error(size_t k) const {
+		size_t n = entries[0]->score.size();
+		double m = difference(k), sq = 0;
+		for (size_t i = 0; i < n; i++) {
+			double d = double(entries[k]->score[i]) - double(entries[0]->score[i]) - m;
+			sq += d * d;
+		}
+		return n > 1 ? std::sqrt(sq / (n - 1) / n) : 0;
+	}
+	double z(size_t k) const {
+		double se = error(k);
+		return se > 0 ? difference(k) / se : 0;
+	}
+	bool significant(size_t k) const {
+		return bound > 0 && std::abs(z(k)) > bound;
+	}
+	bool decided() const {
+		for (size_t k = 1; k < entries.size(); k++) if (!significant(k)) return false;
+		return true;
+	}
+
+	static double phi(double x) {
+		return 0.5 * std::erfc(-x / std::sqrt(2.0));
+	}
+	static double quantile(double p) { // the inverse of phi, by bisection
+		double lo = -40, hi = 40;
+		for (int i = 0; i < 200; i++) {
+			double mid = (lo + hi) / 2;
+			(phi(mid) < p ? lo : hi) = mid;
+		}
+		return (lo + hi) / 2;
+	}
+
+private:
+	double confidence;
+	unsigned seed;
+	double bound;
+	double spent;
+	std::vector<std::unique_ptr<network>> entries;
+};
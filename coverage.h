@@ -0,0 +1,165 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * coverage.h: Coverage and occupancy instrumentation of the weight tables
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+
+/**
+ * the usage of each weight table by the TD updates
+ *
+ * each table keeps a bitmap of the touched entries, its update count, and the update
+ * count of each index range, where a range is the entries sharing the leading 2 cells
+ * of the tuple (e.g., [3,5,*,*,*] has 25^3 entries); the magnitudes of the updates are
+ * counted in a histogram of powers of 2
+ *
+ * the counters are written without synchronization, so they are approximate when
+ * several threads update the tables
+ */
+class coverage {
+public:
+	coverage(const std::vector<std::vector<unsigned>>& tuples) : histogram(), mark(), updates(0), last(0) {
+		for (auto& tuple : tuples) {
+			size_t size = std::pow(25, tuple.size());
+			size_t range = tuple.size() > 2 ? std::pow(25, tuple.size() - 2) : 1;
+			tables.emplace_back(table{ tuple, size, range, std::vector<uint64_t>((size + 63) / 64), 0, std::vector<uint64_t>(size / range) });
+		}
+	}
+
+	/**
+	 * record an update to entry 'index' of table 't', and the magnitude of an update
+	 */
+	void touch(unsigned t, uint32_t index) {
+		table& tab = tables[t];
+		tab.touched[index / 64] |= uint64_t(1) << (index % 64);
+		tab.updates++;
+		tab.hits[index / tab.range]++;
+	}
+	void update(float adjust) {
+		int e = adjust != 0 ? std::ilogb(adjust) : -bias;
+		histogram[std::max(std::min(e + bias, int(buckets - 1)), 0)]++;
+		updates++;
+	}
+
+	/**
+	 * the format would be
+	 * coverage = 4.2% touched (9.8M/234.4M), 1.9M updates, |delta| p50 2^-9, p99 2^-5
+	 *
+	 * where 'touched' is the entries updated at least once, 'updates' is the TD updates
+	 * since the last report, and 'delta' is the magnitude of those updates
+	 */
+	void report(std::ostream& out) {
+		size_t touched = 0, entries = 0;
+		for (const table& tab : tables) touched += count(tab), entries += tab.size;
+		std::array<size_t, buckets> recent;
+		for (size_t b = 0; b < buckets; b++) recent[b] = histogram[b] - mark[b];
+		mark = histogram;
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(1);
+		out << "\t" "coverage = " << (touched * 100.0 / std::max(entries, size_t(1))) << "% touched (";
+		out << (touched * 1e-6) << "M/" << (entries * 1e-6) << "M), " << ((updates - last) * 1e-6) << "M updates";
+		out << ", |delta| p50 2^" << quantile(recent, 0.5) << ", p99 2^" << quantile(recent, 0.99) << std::endl;
+		out.copyfmt(ff);
+		last = updates;
+	}
+
+	/**
+	 * write the details of each table, e.g.,
+	 * tuple 0-1-2-3-4: 1.2M/9.8M touched (12.6%), 31.5M updates, hot [3,5,*,*,*] 4.1%, [2,3,*,*,*] 3.8%, ...
+	 * delta: 2^-12 0.1% 2^-11 0.4% ...
+	 *
+	 * where a hot range is given by the tile indices of its leading 2 cells, and its share of the updates
+	 */
+	void dump(std::ostream& out, size_t hottest = 5) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(1);
+		for (const table& tab : tables) {
+			size_t touched = count(tab), entries = tab.size;
+			out << "tuple ";
+			for (size_t k = 0; k < tab.tuple.size(); k++) out << (k ? "-" : "") << tab.tuple[k];
+			out << ": " << (touched * 1e-6) << "M/" << (entries * 1e-6) << "M touched (" << (touched * 100.0 / entries) << "%)";
+			out << ", " << (tab.updates * 1e-6) << "M updates, hot";
+			std::vector<size_t> order(tab.hits.size());
+			std::iota(order.begin(), order.end(), 0);
+			size_t top = std::min(hottest, order.size());
+			std::partial_sort(order.begin(), order.begin() + top, order.end(),
+				[&](size_t a, size_t b) { return tab.hits[a] > tab.hits[b]; });
+			for (size_t i = 0; i < top && tab.hits[order[i]]; i++) {
+				out << (i ? ", [" : " [") << (order[i] / 25) << "," << (order[i] % 25);
+				for (size_t k = 2; k < tab.tuple.size(); k++) out << ",*";
+				out << "] " << (tab.hits[order[i]] * 100.0 / std::max(tab.updates, size_t(1))) << "%";
+			}
+			out << std::endl;
+		}
+		out << "delta:";
+		size_t total = std::max(std::accumulate(histogram.begin(), histogram.end(), size_t(0)), size_t(1));
+		for (size_t b = 0; b < buckets; b++) {
+			if (histogram[b]) out << " 2^" << (int(b) - bias) << " " << (histogram[b] * 100.0 / total) << "%";
+		}
+		out << std::endl;
+		out.copyfmt(ff);
+	}
+
+	/**
+	 * rewrite the details to a file, which is replaced by rename()
+	 */
+	void dump(const std::string& path) const {
+		std::ofstream out(path + ".tmp", std::ios::out | std::ios::trunc);
+		dump(out);
+		out.close();
+		if (!out || std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+			std::cerr << "cannot write " << path << std::endl;
+	}
+
+protected:
+	struct table {
+		std::vector<unsigned> tuple;
+		size_t size;
+		size_t range; // the entries of an index range
+		std::vector<uint64_t> touched;
+		size_t updates;
+		std::vector<uint64_t> hits; // the updates of each index range
+	};
+
+	static size_t count(const table& tab) {
+		size_t n = 0;
+		for (uint64_t bits : tab.touched) n += __builtin_popcountll(bits);
+		return n;
+	}
+
+	template<typename array>
+	static int quantile(const array& hist, double q) {
+		size_t total = std::accumulate(hist.begin(), hist.end(), size_t(0)), sum = 0;
+		for (size_t b = 0; b < hist.size(); b++) {
+			if ((sum += hist[b]) > q * total) return int(b) - bias;
+		}
+		return int(hist.size()) - 1 - bias;
+	}
+
+private:
+	static constexpr int bias = 30; // 2^-30 to 2^9
+	static constexpr size_t buckets = 40;
+	std::vector<table> tables;
+	std::array<size_t, buckets> histogram;
+	std::array<size_t, buckets> mark;
+	size_t updates;
+	size_t last;
+};
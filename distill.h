@@ -0,0 +1,332 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * distill.h: Distillation of a trained network into a smaller tuple set
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+#include "replay.h"
+#include "profiler.h"
+
+/**
+ * fit a student player to the afterstate values of a teacher player
+ *
+ * the positions are the afterstates of the teacher's own games, played by several threads,
+ * or of recorded episodes (see replay.h); each afterstate is fitted by the update of
+ * adjust_value with the teacher's value as the target, at the learning rate of the student,
+ * and the student tables are shared by the threads without locking
+ *
+ * afterwards, both players are evaluated on the same seeded games, and their evaluators
+ * are timed on the afterstates of the teacher's evaluation games; with 'quantize', the student
+ * is also evaluated with its tables stored as 16-bit integers (see quantized)
+ */
+class distill {
+public:
+	distill(const player& teacher, player& student, const std::string& evil_args, size_t threads, bool quantize = false)
+		: teacher(teacher), student(student), threads(std::max(threads, size_t(1))), seed(std::random_device()()),
+		  quantize(quantize), next(0), square(0), positions(0) {
+		std::stringstream ss(evil_args);
+		for (std::string pair; ss >> pair; ) {
+			if (pair.find("seed=") == 0) seed = std::stoul(pair.substr(5));
+		}
+	}
+
+	/**
+	 * fit the student to the remaining episodes of 'stat', which are the teacher's games
+	 */
+	void run(statistic& stat) {
+		stat.attach([this](std::ostream& out) { report(out); });
+		size_t total = stat.remaining();
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < threads; i++) workers.emplace_back(&distill::worker, this, std::ref(stat), total);
+		for (std::thread& t : workers) t.join();
+	}
+
+	/**
+	 * fit the student to the recorded episodes of the logs
+	 */
+	void run(statistic& stat, const std::vector<std::string>& logs) {
+		stat.attach([this](std::ostream& out) { report(out); });
+		replay source(student, logs, threads);
+		source.learn_with([this](const std::vector<player::step>& history) { learn(history); });
+		source.run(stat);
+	}
+
+	/**
+	 * the format would be
+	 * distill = 1.2M positions, rmse 812.4
+	 *
+	 * where 'rmse' is the error of the student before its updates since the last report
+	 */
+	void report(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "distill = " << std::fixed << std::setprecision(1) << (positions * 1e-6) << "M positions";
+		out << ", rmse " << std::sqrt(square / std::max(positions, size_t(1))) << std::endl;
+		out.copyfmt(ff);
+		square = 0;
+		positions = 0;
+	}
+
+	/**
+	 * compare the student with the teacher on the same seeded games, e.g.,
+	 * teacher    avg = 61140, 2584 = 31.0%, 1870 ns/eval, 940.0 MB
+	 * student    avg = 40210, 2584 = 12.0%, 160 ns/eval, 78.1 MB
+	 * int16      avg = 40150, 2584 = 11.9%, 150 ns/eval, 39.1 MB
+	 * student keeps 65.8% of the score at 11.7x the speed, rmse 812.4
+	 * int16 keeps 65.7% of the score at 12.5x the speed, rmse 812.6
+	 *
+	 * where 'ns/eval' is the time of estimate_value, 'MB' is the size of the tables, and 'rmse'
+	 * is the error against the teacher on the afterstates of the teacher's games; the 'int16'
+	 * lines are printed with 'quantize'
+	 */
+	void evaluate(std::ostream& out, size_t games, unsigned goal) {
+		std::vector<board> sample;
+		std::vector<result> rows;
+		rows.push_back(evaluate("teacher", teacher, games, goal, &sample));
+		rows.push_back(evaluate("student", student, games, goal, nullptr));
+		quantized low(student);
+		if (quantize) rows.push_back(evaluate("int16", low, games, goal, nullptr));
+		rows[0].time = timing(teacher, sample);
+		rows[1].time = timing(student, sample);
+		rows[1].rmse = rmse(student, sample);
+		if (quantize) {
+			rows[2].time = timing(low, sample);
+			rows[2].rmse = rmse(low, sample);
+		}
+		rows[0].bytes = bytes(teacher);
+		rows[1].bytes = bytes(student);
+		if (quantize) rows[2].bytes = low.bytes();
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed;
+		for (const result& r : rows) {
+			out << std::left << std::setw(10) << r.name << std::right << " avg = " << std::setprecision(0) << r.avg;
+			out << ", " << board::fibonacci(board::index(goal)) << " = " << std::setprecision(1) << (r.rate * 100) << "%";
+			out << ", " << std::setprecision(0) << r.time << " ns/eval";
+			out << ", " << std::setprecision(1) << (r.bytes / 1048576.0) << " MB" << std::endl;
+		}
+		for (size_t i = 1; i < rows.size(); i++) {
+			const result& t = rows[0], & s = rows[i];
+			out << s.name << " keeps " << std::setprecision(1) << (s.avg * 100 / std::max(t.avg, 1.0)) << "% of the score at ";
+			out << (t.time / std::max(s.time, 1e-9)) << "x the speed, rmse " << s.rmse << std::endl;
+		}
+		out.copyfmt(ff);
+	}
+
+	/**
+	 * the tables of a player stored as 16-bit integers, with a scale per table so that
+	 * the largest magnitude of a table is 32767; an entry is read as 'scale * entry'
+	 *
+	 * it takes half the memory of the float tables, evaluates by the features of the player,
+	 * and is meant for evaluation only (the player is not changed)
+	 */
+	class quantized {
+	public:
+		quantized(const player& play) : play(play) {
+			for (const weight& w : play.weights()) {
+				float top = 0;
+				for (size_t i = 0; i < w.size(); i++) top = std::max(top, std::abs(w[i]));
+				float scale = top > 0 ? top / 32767 : 1;
+				std::vector<int16_t> q(w.size());
+				for (size_t i = 0; i < w.size(); i++) q[i] = int16_t(std::lround(w[i] / scale));
+				tables.push_back(std::move(q));
+				scales.push_back(scale);
+			}
+		}
+		float estimate_value(const board& after) const {
+			uint32_t index[player::max_features];
+			play.extract_features(after, index);
+			const std::vector<player::feature>& features = play.feature_set();
+			float value = 0;
+			for (size_t i = 0, n = features.size(); i < n; i++) {
+				unsigned t = features[i].table;
+				value += scales[t] * tables[t][index[i]];
+			}
+			return value;
+		}
+		const player& owner() const { return play; }
+		size_t bytes() const {
+			size_t sum = 0;
+			for (const std::vector<int16_t>& q : tables) sum += q.size() * sizeof(int16_t);
+			return sum;
+		}
+
+	private:
+		const player& play;
+		std::vector<std::vector<int16_t>> tables;
+		std::vector<float> scales;
+	};
+
+protected:
+	struct result {
+		const char* name;
+		double avg;
+		double rate;
+		double time;
+		double rmse;
+		size_t bytes;
+	};
+
+	void worker(statistic& stat, size_t total) {
+		std::vector<player::step> history;
+		for (size_t i; (i = next.fetch_add(1)) < total; ) {
+			episode game;
+			play(teacher, seed + i, game, history);
+			learn(history);
+			std::lock_guard<std::mutex> lock(record);
+			stat.push(game);
+		}
+	}
+
+	/**
+	 * play a game without learning with the environment of the given seed, and keep its afterstates
+	 */
+	static void play(const player& who, unsigned seed, episode& game, std::vector<player::step>& history) {
+		play(who, who, seed, game, history);
+	}
+
+	/**
+	 * play a game as above, with the moves selected by the values of 'eval' as select_action does
+	 */
+	template<typename evaluator>
+	static void play(const player& who, const evaluator& eval, unsigned seed, episode& game, std::vector<player::step>& history) {
+		player& play = const_cast<player&>(who); // only to take turns, the player is not changed
+		rndenv evil("seed=" + std::to_string(seed));
+		game.open_episode(play.name() + ":" + evil.name());
+		history.clear();
+		while (true) {
+			agent& turn = game.take_turns(play, evil);
+			action move;
+			if (&turn == &play) {
+				player::step best;
+				int op = select(eval, game.state(), best);
+				if (op != -1) history.push_back(best);
+				move = action::slide(op);
+			} else {
+				move = turn.take_action(game.state());
+			}
+			if (game.apply_action(move) != true) break;
+		}
+		agent& win = game.last_turns(play, evil);
+		game.close_episode(win.name());
+	}
+
+	static const player& owner(const player& eval) { return eval; }
+	static const player& owner(const quantized& eval) { return eval.owner(); }
+	static int select(const player& eval, const board& before, player::step& best) {
+		return eval.select_action(before, best);
+	}
+	static int select(const quantized& eval, const board& before, player::step& best) {
+		int best_op = -1;
+		float best_value = -std::numeric_limits<float>::max();
+		for (int op : { 0, 1, 2, 3 }) {
+			board after = before;
+			int reward = after.slide(op);
+			if (reward == -1) continue;
+			float value = reward + eval.estimate_value(after);
+			if (value > best_value) {
+				best_op = op;
+				best_value = value;
+				best = { reward, after };
+			}
+		}
+		return best_op;
+	}
+
+	void learn(const std::vector<player::step>& history) {
+		double sq = student.fit(history, teacher);
+		std::lock_guard<std::mutex> lock(mutex);
+		square += sq;
+		positions += history.size();
+	}
+
+	/**
+	 * play the evaluation games, which follow the training seeds, and keep their afterstates in 'sample'
+	 */
+	template<typename evaluator>
+	result evaluate(const char* name, const evaluator& eval, size_t games, unsigned goal, std::vector<board>* sample) {
+		result r = {};
+		r.name = name;
+		std::vector<player::step> history;
+		for (size_t i = 0; i < games; i++) {
+			episode game;
+			play(owner(eval), eval, seed + (1u << 30) + i, game, history);
+			const board& state = game.state();
+			r.avg += game.score();
+			r.rate += *std::max_element(&state(0), &state(16)) >= unsigned(board::index(goal));
+			for (size_t k = 0; sample && k < history.size() && sample->size() < limit; k++) sample->push_back(history[k].after);
+		}
+		r.avg /= std::max(games, size_t(1));
+		r.rate /= std::max(games, size_t(1));
+		return r;
+	}
+
+	/**
+	 * the average time of estimate_value on the sample, in nanoseconds
+	 */
+	template<typename evaluator>
+	static double timing(const evaluator& eval, const std::vector<board>& sample) {
+		if (sample.empty()) return 0;
+		volatile float sink = 0;
+		profiler::tick start = profiler::nanosec();
+		for (int rep = 0; rep < 3; rep++)
+			for (const board& after : sample) sink = sink + eval.estimate_value(after);
+		return double(profiler::nanosec() - start) / (3 * sample.size());
+	}
+
+	/**
+	 * the root mean square error against the teacher on the sample
+	 */
+	template<typename evaluator>
+	double rmse(const evaluator& eval, const std::vector<board>& sample) const {
+		double sq = 0;
+		for (const board& after : sample) {
+			double error = teacher.estimate_value(after) - eval.estimate_value(after);
+			sq += error * error;
+		}
+		return std::sqrt(sq / std::max(sample.size(), size_t(1)));
+	}
+
+	static size_t bytes(const player& play) {
+		size_t sum = 0;
+		for (const weight& w : play.weights()) sum += w.size() * sizeof(weight::type);
+		return sum;
+	}
+
+private:
+	static constexpr size_t limit = 100000; // the afterstates to time the evaluators
+	const player& teacher;
+	player& student;
+	size_t threads;
+	unsigned seed;
+	bool quantize;
+	std::atomic<size_t> next;
+	std::mutex mutex;
+	std::mutex record;
+	double square;
+	size_t positions;
+};
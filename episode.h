@@ -15,9 +15,11 @@
 #include <sstream>
 #include <chrono>
 #include <numeric>
+#include <cstdint>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
+#include "profiler.h"
 
 class statistic;
 
@@ -31,6 +33,18 @@ public:
 	const board& state() const { return ep_state; }
 	board::reward score() const { return ep_score; }
 
+	/**
+	 * reset to a fresh episode while keeping the allocated move buffer
+	 */
+	void clear() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_open = {};
+		ep_close = {};
+	}
+
 	void open_episode(const std::string& tag) {
 		ep_open = { tag, millisec() };
 	}
@@ -40,18 +54,36 @@ public:
 	bool apply_action(action move) {
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		ep_moves.emplace_back(move, reward, nanosec() - ep_time);
 		ep_score += reward;
 		return true;
 	}
+	/**
+	 * append a move which is already applied to the state, e.g., by a simulator of many games
+	 * where 'time' is the thinking time of the move in nanoseconds
+	 */
+	void record_action(action move, board::reward reward, time_t time) {
+		ep_moves.emplace_back(move, reward, time);
+		ep_score += reward;
+	}
 	agent& take_turns(agent& play, agent& evil) {
-		ep_time = millisec();
+		ep_time = nanosec();
 		return (std::max(step() + 1, size_t(2)) % 2) ? play : evil;
 	}
 	agent& last_turns(agent& play, agent& evil) {
 		return take_turns(evil, play);
 	}
 
+	/**
+	 * stop and restart the clock of the current turn, e.g., while other games are played
+	 */
+	void pause_turn() {
+		ep_time = nanosec() - ep_time;
+	}
+	void resume_turn() {
+		ep_time = nanosec() - ep_time;
+	}
+
 public:
 	size_t step(unsigned who = -1u) const {
 		int size = ep_moves.size(); // 'int' is important for handling 0
@@ -62,6 +94,10 @@ public:
 		}
 	}
 
+	/**
+	 * the elapsed time of the episode in milliseconds (wall clock),
+	 * or the thinking time of a player or an environment in nanoseconds
+	 */
 	time_t time(unsigned who = -1u) const {
 		time_t time = 0;
 		size_t i = 2;
@@ -120,8 +156,48 @@ public:
 		return in;
 	}
 
+	/**
+	 * parse an episode from the text [first, last) in the format of operator <<, without any stream
+	 * the actions are decoded by table lookups; as operator >> does, an unknown action skips
+	 * 2 characters, and the state and the score are rebuilt by applying the actions, or, if
+	 * 'replay' is false, the score is the sum of the recorded rewards and the state is kept empty
+	 *
+	 * return false if the text is not a whole episode
+	 */
+	bool parse(const char* first, const char* last, bool replay = true) {
+		clear();
+		const char* p = first;
+		if (!scan(p, last, ep_open) || p++ == last) return false;
+		while (p < last && *p != '|') {
+			action code; // unknown
+			if (last - p >= 2 && p[0] == '#' && codes().oper[uint8_t(p[1])] < 4) {
+				code = action::slide(codes().oper[uint8_t(p[1])]);
+			} else if (last - p >= 2 && codes().index[uint8_t(p[0])] < 16 && codes().index[uint8_t(p[1])] < 36) {
+				code = action::place(codes().index[uint8_t(p[0])], codes().index[uint8_t(p[1])]);
+			}
+			p += std::min<ptrdiff_t>(2, last - p);
+			board::reward reward = 0;
+			time_t time = 0;
+			if (p < last && *p == '[') reward = number(++p, last), p += (p < last);
+			if (p < last && *p == '(') {
+				time = number(++p, last);
+				if (p < last && *p == 'n') p++;
+				else time *= 1000000; // milliseconds, as operator >> does
+				p += (p < last);
+			}
+			ep_moves.emplace_back(code, reward, time);
+			ep_score += replay ? code.apply(ep_state) : reward;
+		}
+		return p < last && scan(++p, last, ep_close) && p == last;
+	}
+
 protected:
 
+	/**
+	 * a move is written as its action, its reward as '[reward]' if any, and its time as '(time)'
+	 * in milliseconds if not 0, e.g., "#U[8](2)", as the time is kept in nanoseconds only in memory;
+	 * a time marked as '(time n)' is in nanoseconds, which is also read
+	 */
 	struct move {
 		action code;
 		board::reward reward;
@@ -132,7 +208,7 @@ protected:
 		friend std::ostream& operator <<(std::ostream& out, const move& m) {
 			out << m.code;
 			if (m.reward) out << '[' << std::dec << m.reward << ']';
-			if (m.time) out << '(' << std::dec << m.time << ')';
+			if (m.time / 1000000) out << '(' << std::dec << (m.time / 1000000) << ')';
 			return out;
 		}
 		friend std::istream& operator >>(std::istream& in, move& m) {
@@ -147,6 +223,8 @@ protected:
 			if (in.peek() == '(') {
 				in.ignore(1);
 				in >> std::dec >> m.time;
+				if (in.peek() == 'n') in.ignore(1);
+				else m.time *= 1000000; // milliseconds
 				in.ignore(1);
 			}
 			return in;
@@ -166,6 +244,39 @@ protected:
 		}
 	};
 
+	/**
+	 * the values of the characters in the action formats, or 255 for the others:
+	 * 'index' maps 0-9 and A-Z to 0-35, and 'oper' maps U, R, D, L to 0-3
+	 */
+	struct code_table {
+		uint8_t index[256];
+		uint8_t oper[256];
+		code_table() {
+			std::fill(index, index + 256, 255);
+			std::fill(oper, oper + 256, 255);
+			for (unsigned i = 0; i < 36; i++) index[uint8_t("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[i])] = i;
+			for (unsigned i = 0; i < 4; i++) oper[uint8_t("URDL"[i])] = i;
+		}
+	};
+	static const code_table& codes() {
+		static const code_table table;
+		return table;
+	}
+	static time_t number(const char*& p, const char* last) {
+		bool minus = (p < last && *p == '-');
+		time_t v = 0;
+		for (p += minus; p < last && *p >= '0' && *p <= '9'; p++) v = v * 10 + (*p - '0');
+		return minus ? -v : v;
+	}
+	static bool scan(const char*& p, const char* last, meta& m) {
+		const char* at = std::find(p, last, '@');
+		if (at == last) return false;
+		m.tag.assign(p, at);
+		p = at + 1;
+		m.when = number(p, last);
+		return p == last || *p == '|';
+	}
+
 	static board initial_state() {
 		return {};
 	}
@@ -173,6 +284,9 @@ protected:
 		auto now = std::chrono::system_clock::now().time_since_epoch();
 		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
 	}
+	static time_t nanosec() {
+		return profiler::nanosec();
+	}
 
 private:
 	board ep_state;
@@ -0,0 +1,209 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * interleave.h: Interleaved multi-game scheduler to hide the latency of weight lookups
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+#include "profiler.h"
+
+/**
+ * play several independent games in one thread as hand-rolled state machines
+ *
+ * a game is suspended right after it has computed the feature indices of its next
+ * afterstates (or of its next TD update) and prefetched the entries; the other games
+ * run in the meantime, so the entries are likely in the cache when the game resumes
+ *
+ * the games share the player and the environment; with a single game, the moves and
+ * the updates are exactly those of the plain game loop
+ *
+ * with 'update=online', each game keeps a window of the player instead of its history,
+ * and does the online updates as it moves (see player::observe); 'update=sorted' is not
+ * supported, since the backward pass of each game is done here instead of by player::learn
+ */
+class interleave {
+public:
+	interleave(player& play, rndenv& evil, size_t width)
+		: play(play), evil(evil), slots(std::max(width, size_t(1))), moves(0), mark(profiler::nanosec()) {}
+
+	/**
+	 * run the remaining episodes of 'stat', and learn from them if the player has a learning rate
+	 * the report is attached to 'stat', so the scheduler should outlive it
+	 */
+	void run(statistic& stat) {
+		stat.attach([this](std::ostream& out) { report(out); });
+		size_t games = stat.remaining(), issued = 0, active = 0;
+		learning = play.learning_rate() != 0;
+		for (slot& s : slots) {
+			if (issued == games) break;
+			start(s), issued++, active++;
+		}
+		while (active) {
+			for (slot& s : slots) {
+				if (s.stage == slot::idle) continue;
+				if (s.stage == slot::think) think(s);
+				else update(s);
+				if (s.stage != slot::finish) continue;
+				stat.push(s.game);
+				if (issued < games) start(s), issued++;
+				else s.stage = slot::idle, active--;
+			}
+		}
+	}
+
+	/**
+	 * the format would be
+	 * interleave = 16 games, 221803 moves/s
+	 *
+	 * where 'moves/s' is the player moves per second of all games since the last report
+	 */
+	void report(std::ostream& out) {
+		profiler::tick now = profiler::nanosec();
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "interleave = " << slots.size() << " games, ";
+		out << std::fixed << std::setprecision(0) << (moves * 1e9 / std::max(now - mark, profiler::tick(1))) << " moves/s" << std::endl;
+		out.copyfmt(ff);
+		moves = 0;
+		mark = now;
+	}
+
+protected:
+	struct slot {
+		enum { idle, think, learn, finish } stage;
+		episode game;
+		std::vector<player::step> history;
+		player::window recent;
+		player::step after[4]; // the candidate afterstates, with reward -1 if illegal
+		uint32_t index[4][player::max_features];
+		uint32_t trace[2][player::max_features]; // the indices of the current and the last TD update
+		size_t t; // the position of the TD update
+		float target;
+		slot() : stage(idle), t(0), target(0) {}
+	};
+
+	void start(slot& s) {
+		s.game.clear();
+		s.history.clear();
+		s.recent.reset(std::max(play.online_steps(), size_t(1)));
+		s.game.open_episode(play.name() + ":" + evil.name());
+		s.stage = slot::think;
+		advance(s);
+	}
+
+	/**
+	 * let the environment move until it is the player's turn, then prepare the afterstates
+	 */
+	void advance(slot& s) {
+		while (true) {
+			agent& who = s.game.take_turns(play, evil);
+			if (&who == &play) break;
+			if (s.game.apply_action(who.take_action(s.game.state())) != true) return close(s);
+		}
+		profiler::scope phase(profiler::slide);
+		for (int op = 0; op < 4; op++) {
+			s.after[op].after = s.game.state();
+			s.after[op].reward = s.after[op].after.slide(op);
+		}
+		phase.shift(profiler::feature);
+		for (int op = 0; op < 4; op++) {
+			if (s.after[op].reward == -1) continue;
+			play.extract_features(s.after[op].after, s.index[op]);
+			play.prefetch(s.index[op]);
+		}
+		s.game.pause_turn();
+	}
+
+	/**
+	 * choose the move with the prefetched entries, as player::select_action does
+	 */
+	void think(slot& s) {
+		s.game.resume_turn();
+		int best_op = -1;
+		int best_reward = -1;
+		float best_value = -std::numeric_limits<float>::max();
+		{
+			profiler::scope phase(profiler::lookup);
+			for (int op = 0; op < 4; op++) {
+				int reward = s.after[op].reward;
+				if (reward == -1) continue;
+				float value = play.lookup_value(s.index[op]);
+				if (reward + value > best_reward + best_value) {
+					best_op = op;
+					best_reward = reward;
+					best_value = value;
+				}
+			}
+		}
+		if (best_op != -1 && play.online_steps()) {
+			if (learning) play.observe(s.recent, s.after[best_op]);
+		} else if (best_op != -1) {
+			s.history.push_back(s.after[best_op]);
+		}
+		moves++;
+		if (s.game.apply_action(action::slide(best_op)) != true) return close(s);
+		advance(s);
+	}
+
+	void close(slot& s) {
+		agent& win = s.game.last_turns(play, evil);
+		s.game.close_episode(win.name());
+		if (learning && play.online_steps()) play.finish(s.recent);
+		if (!learning || s.history.empty()) {
+			s.stage = slot::finish;
+			return;
+		}
+		s.stage = slot::learn;
+		s.t = s.history.size() - 1;
+		s.target = 0;
+		prepare(s, s.trace[s.t % 2]);
+	}
+
+	/**
+	 * one step of the TD backward pass of player::learn, with the entries of step t prefetched
+	 */
+	void update(slot& s) {
+		uint32_t* index = s.trace[s.t % 2];
+		{
+			profiler::scope phase(profiler::lookup);
+			float current = play.lookup_value(index);
+			phase.shift(profiler::update);
+			play.add_value(index, play.learning_rate() * (s.target - current));
+		}
+		if (s.t == 0) {
+			s.stage = slot::finish;
+			return;
+		}
+		profiler::scope phase(profiler::lookup);
+		s.target = s.history[s.t].reward + play.lookup_value(index);
+		s.t--;
+		prepare(s, s.trace[s.t % 2]);
+	}
+
+	void prepare(slot& s, uint32_t* index) {
+		profiler::scope phase(profiler::feature);
+		play.extract_features(s.history[s.t].after, index);
+		play.prefetch(index);
+	}
+
+private:
+	player& play;
+	rndenv& evil;
+	std::vector<slot> slots;
+	bool learning;
+	size_t moves;
+	profiler::tick mark;
+};
@@ -0,0 +1,327 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * lockstep.h: Structure-of-arrays simulator of many games in lockstep
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <limits>
+#include <cstdint>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+#include "profiler.h"
+
+/**
+ * play 'lanes' games at once without learning, for evaluating a player on many games
+ *
+ * the boards are kept as 16 arrays of tile indices, one element per lane, and every step
+ * advances all the lanes together:
+ *  1) the 4 slides of every lane are computed by a branchless kernel over the lanes,
+ *     which reads a row of every board in the slide direction, so no board is rotated
+ *  2) the afterstates of all the lanes are evaluated together, one feature at a time
+ *  3) the best slides are applied, and the environment places a tile in every lane
+ * a finished lane is recorded to the statistic and refilled with the next game
+ *
+ * the environment of game g has its own generator seeded by 'seed' and g, and places a 1
+ * (90%) or a 2 on a uniformly chosen empty cell as rndenv does, so the games do not depend
+ * on the number of lanes; each lane keeps an episode, so it takes the memory of one episode
+ */
+class lockstep {
+public:
+	lockstep(player& play, const std::string& evil_args, size_t lanes)
+		: play(play), width((std::max(lanes, size_t(1)) + 15) / 16 * 16), seed(std::random_device()()),
+		  moves(0), mark(profiler::nanosec()) {
+		std::stringstream ss(evil_args);
+		for (std::string pair; ss >> pair; ) {
+			if (pair.find("seed=") == 0) seed = std::stoul(pair.substr(5));
+		}
+		cell.assign(16 * width, 0);
+		after.assign(4 * 16 * width, 0);
+		gain.assign(4 * width, 0);
+		moved.assign(4 * width, 0);
+		chosen.assign(width, 0);
+		merged.assign(3 * width, 0);
+		value.assign(4 * width, 0);
+		index.assign(width, 0);
+		slots.resize(std::max(lanes, size_t(1)));
+	}
+
+	/**
+	 * play the remaining episodes of 'stat'
+	 * the report is attached to 'stat', so the simulator should outlive it
+	 */
+	void run(statistic& stat) {
+		stat.attach([this](std::ostream& out) { report(out); });
+		size_t games = stat.remaining(), issued = 0, active = 0;
+		for (slot& s : slots) {
+			s.active = issued < games;
+			if (s.active) start(s, &s - slots.data(), issued++), active++;
+		}
+		while (active) {
+			profiler::tick begin = profiler::nanosec();
+			{
+				profiler::scope phase(profiler::slide);
+				for (unsigned op = 0; op < 4; op++) slide(op);
+			}
+			for (unsigned op = 0; op < 4; op++) evaluate(op);
+
+			profiler::scope phase(profiler::slide);
+			std::fill(chosen.begin(), chosen.end(), 4); // no legal slide
+			for (size_t l = 0; l < slots.size(); l++) {
+				float best = -std::numeric_limits<float>::max();
+				int best_reward = -1;
+				for (unsigned op = 0; op < 4; op++) {
+					if (!moved[op * width + l]) continue;
+					int reward = gain[op * width + l];
+					float v = value[op * width + l];
+					if (reward + v > best_reward + best) {
+						chosen[l] = op;
+						best_reward = reward;
+						best = v;
+					}
+				}
+			}
+			apply();
+			profiler::tick think = (profiler::nanosec() - begin) / active;
+
+			phase.shift(profiler::environment);
+			begin = profiler::nanosec();
+			for (size_t l = 0; l < slots.size(); l++) {
+				slot& s = slots[l];
+				if (!s.active || chosen[l] == 4) continue;
+				s.game.record_action(action::slide(chosen[l]), gain[chosen[l] * width + l], think);
+				place(s, l);
+				moves++;
+			}
+			profiler::tick env = (profiler::nanosec() - begin) / active;
+			for (size_t l = 0; l < slots.size(); l++) {
+				slot& s = slots[l];
+				if (!s.active) continue;
+				if (chosen[l] != 4) {
+					s.pending = env;
+					continue;
+				}
+				close(s, l);
+				stat.push(s.game);
+				if (issued < games) start(s, l, issued++);
+				else s.active = false, active--;
+			}
+		}
+	}
+
+	/**
+	 * the format would be
+	 * lockstep = 1024 lanes, 2218030 moves/s
+	 *
+	 * where 'moves/s' is the player moves per second of all lanes since the last report
+	 */
+	void report(std::ostream& out) {
+		profiler::tick now = profiler::nanosec();
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "lockstep = " << slots.size() << " lanes, ";
+		out << std::fixed << std::setprecision(0) << (moves * 1e9 / std::max(now - mark, profiler::tick(1))) << " moves/s" << std::endl;
+		out.copyfmt(ff);
+		moves = 0;
+		mark = now;
+	}
+
+protected:
+	struct slot {
+		bool active;
+		uint64_t rng;
+		episode game;
+		profiler::tick pending; // the time of the last placement, recorded with it
+	};
+
+	uint8_t* tiles(unsigned c) { return &cell[c * width]; }
+	uint8_t* slid(unsigned op, unsigned c) { return &after[(op * 16 + c) * width]; }
+
+	/**
+	 * slide all the lanes in direction 'op', and store the afterstates, the rewards, and whether they moved
+	 * a row is read from the edge which the tiles slide towards, so the kernel is that of slide_left
+	 */
+	void slide(unsigned op) {
+		static const unsigned rows[4][4][4] = {
+			{ { 0, 4, 8, 12 }, { 1, 5, 9, 13 }, { 2, 6, 10, 14 }, { 3, 7, 11, 15 } }, // up
+			{ { 3, 2, 1, 0 }, { 7, 6, 5, 4 }, { 11, 10, 9, 8 }, { 15, 14, 13, 12 } }, // right
+			{ { 12, 8, 4, 0 }, { 13, 9, 5, 1 }, { 14, 10, 6, 2 }, { 15, 11, 7, 3 } }, // down
+			{ { 0, 1, 2, 3 }, { 4, 5, 6, 7 }, { 8, 9, 10, 11 }, { 12, 13, 14, 15 } }, // left
+		};
+		uint32_t* reward = &gain[op * width];
+		uint8_t* change = &moved[op * width];
+		std::fill(reward, reward + width, 0);
+		std::fill(change, change + width, 0);
+		for (unsigned r = 0; r < 4; r++) {
+			const unsigned* row = rows[op][r];
+			uint8_t *t0 = &merged[0], *t1 = &merged[width], *t2 = &merged[2 * width];
+			kernel(width, tiles(row[0]), tiles(row[1]), tiles(row[2]), tiles(row[3]),
+				slid(op, row[0]), slid(op, row[1]), slid(op, row[2]), slid(op, row[3]), change, t0, t1, t2);
+			for (size_t l = 0; l < width; l++) reward[l] += board::fibonacci(t0[l]) + board::fibonacci(t1[l]) + board::fibonacci(t2[l]);
+		}
+	}
+
+	/**
+	 * slide_left of a row in 'n' lanes, from the cells s0-s3 to the cells d0-d3, and mark the lanes which moved
+	 * the merged tiles are stored to t0-t2 (0 if none), and the arrays never overlap, so the loop is vectorized
+	 */
+	static void kernel(size_t n,
+			const uint8_t* __restrict__ s0, const uint8_t* __restrict__ s1, const uint8_t* __restrict__ s2, const uint8_t* __restrict__ s3,
+			uint8_t* __restrict__ d0, uint8_t* __restrict__ d1, uint8_t* __restrict__ d2, uint8_t* __restrict__ d3,
+			uint8_t* __restrict__ change, uint8_t* __restrict__ t0, uint8_t* __restrict__ t1, uint8_t* __restrict__ t2) {
+		for (size_t l = 0; l < n; l++) {
+			uint8_t a = s0[l], b = s1[l], c = s2[l], d = s3[l];
+			uint8_t x0 = a, x1 = b, x2 = c, x3 = d;
+			for (int pass = 0; pass < 3; pass++) { // move the empty cells to the end
+				squeeze(x0, x1);
+				squeeze(x1, x2);
+				squeeze(x2, x3);
+			}
+			uint8_t m0 = mergeable(x0, x1), n0 = std::max(x0, x1) + 1;
+			x0 = select(m0, n0, x0);
+			x1 = select(m0, x2, x1);
+			x2 = select(m0, x3, x2);
+			x3 = x3 & ~m0;
+			uint8_t m1 = mergeable(x1, x2), n1 = std::max(x1, x2) + 1;
+			x1 = select(m1, n1, x1);
+			x2 = select(m1, x3, x2);
+			x3 = x3 & ~m1;
+			uint8_t m2 = mergeable(x2, x3), n2 = std::max(x2, x3) + 1;
+			x2 = select(m2, n2, x2);
+			x3 = x3 & ~m2;
+			d0[l] = x0, d1[l] = x1, d2[l] = x2, d3[l] = x3;
+			change[l] |= (x0 ^ a) | (x1 ^ b) | (x2 ^ c) | (x3 ^ d);
+			t0[l] = n0 & m0;
+			t1[l] = n1 & m1;
+			t2[l] = n2 & m2;
+		}
+	}
+
+	/**
+	 * the lane operations on masks, which are 0xff for true and 0 for false
+	 */
+	static uint8_t select(uint8_t mask, uint8_t u, uint8_t v) {
+		return (u & mask) | (v & ~mask);
+	}
+	static void squeeze(uint8_t& u, uint8_t& v) {
+		uint8_t empty = -uint8_t(u == 0);
+		u = select(empty, v, u);
+		v = v & ~empty;
+	}
+	static uint8_t mergeable(uint8_t u, uint8_t v) {
+		uint8_t both = -uint8_t((u != 0) & (v != 0));
+		uint8_t next = -uint8_t((uint8_t(u - v) == 1) | (uint8_t(v - u) == 1) | ((u == 1) & (v == 1)));
+		return both & next;
+	}
+
+	/**
+	 * evaluate the afterstates of slide 'op' in all the lanes, one feature at a time:
+	 * the indices of a feature are computed for all the lanes, and its entries are loaded
+	 * independently of each other, so many of the loads are in flight at once
+	 */
+	void evaluate(unsigned op) {
+		float* v = &value[op * width];
+		std::fill(v, v + width, 0);
+		const std::vector<weight>& net = play.weights();
+		for (const player::feature& f : play.feature_set()) {
+			profiler::scope phase(profiler::feature);
+			uint32_t* idx = index.data(), base = play.index_base();
+			std::fill(idx, idx + width, 0);
+			for (unsigned k = 0; k < f.length; k++) {
+				const uint8_t* t = slid(op, f.cell[k]);
+				for (size_t l = 0; l < width; l++) idx[l] = idx[l] * base + t[l];
+			}
+			phase.shift(profiler::lookup);
+			const weight& w = net[f.table];
+			for (size_t l = 0; l < width; l++) v[l] += w[idx[l]];
+		}
+	}
+
+	/**
+	 * replace the boards by the afterstates of the chosen slides, or keep them if none is legal
+	 */
+	void apply() {
+		const size_t n = width;
+		for (unsigned c = 0; c < 16; c++) {
+			uint8_t* t = tiles(c);
+			const uint8_t *u = slid(0, c), *r = slid(1, c), *d = slid(2, c), *l = slid(3, c);
+			for (size_t i = 0; i < n; i++) {
+				uint8_t op = chosen[i];
+				t[i] = op == 0 ? u[i] : op == 1 ? r[i] : op == 2 ? d[i] : op == 3 ? l[i] : t[i];
+			}
+		}
+	}
+
+	void start(slot& s, size_t l, size_t game) {
+		s.active = true;
+		s.rng = seed * 0x9e3779b97f4a7c15ull + game;
+		s.pending = 0;
+		s.game.clear();
+		s.game.open_episode(play.name() + ":lockstep");
+		for (unsigned c = 0; c < 16; c++) tiles(c)[l] = 0;
+		place(s, l);
+		place(s, l);
+	}
+
+	/**
+	 * place a tile on a random empty cell of lane 'l', and record it
+	 */
+	void place(slot& s, size_t l) {
+		unsigned empty = 0;
+		for (unsigned c = 0; c < 16; c++) empty += (tiles(c)[l] == 0);
+		if (empty == 0) return;
+		uint64_t r = next(s.rng);
+		unsigned k = (r >> 32) % empty;
+		unsigned tile = (r & 0xffffffffu) % 10 ? 1 : 2;
+		for (unsigned c = 0; c < 16; c++) {
+			if (tiles(c)[l] != 0) continue;
+			if (k-- == 0) {
+				tiles(c)[l] = tile;
+				s.game.record_action(action::place(c, tile), 0, s.pending);
+				break;
+			}
+		}
+		s.pending = 0;
+	}
+
+	void close(slot& s, size_t l) {
+		board& state = s.game.state();
+		for (unsigned c = 0; c < 16; c++) state(c) = tiles(c)[l];
+		s.game.close_episode("lockstep");
+	}
+
+	static uint64_t next(uint64_t& x) { // splitmix64
+		uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+private:
+	player& play;
+	size_t width; // the lanes, rounded up to a multiple of 16
+	unsigned seed;
+	std::vector<uint8_t> cell; // cell[c * width + l], the tile of cell c in lane l
+	std::vector<uint8_t> after; // after[(op * 16 + c) * width + l], the afterstates of slide op
+	std::vector<uint32_t> gain; // gain[op * width + l], the rewards of slide op
+	std::vector<uint8_t> moved; // moved[op * width + l], whether slide op is legal
+	std::vector<uint8_t> chosen; // the slide of each lane, or 4 if none is legal
+	std::vector<uint8_t> merged; // the merged tiles of the current row, at the 3 positions
+	std::vector<float> value; // value[op * width + l], the value of the afterstate of slide op
+	std::vector<uint32_t> index; // the indices of the current feature in all the lanes
+	std::vector<slot> slots;
+	size_t moves;
+	profiler::tick mark;
+};
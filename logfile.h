@@ -0,0 +1,135 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * logfile.h: Parallel loader of the statistic logs
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "episode.h"
+#include "statistic.h"
+#include "profiler.h"
+
+/**
+ * load a log saved by '--save' into a statistic, as operator >> of statistic does
+ *
+ * the file is mapped into memory and split into ranges of whole lines, one per thread;
+ * each line is parsed in place by episode::parse, and the episodes are appended to the
+ * statistic in the order of the file. if 'replay' is false, the boards are not rebuilt,
+ * which keeps the scores, the steps and the times, but not the tiles reached, so the
+ * tile rates of the statistic leave out these episodes
+ */
+class logfile {
+public:
+	logfile(const std::string& path, size_t threads = 0, bool replay = true)
+		: path(path), threads(threads ? threads : std::max(std::thread::hardware_concurrency(), 1u)), replay(replay),
+		  data(nullptr), size(0), loaded(0), broken(0), elapsed(0) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (fd < 0 || ::fstat(fd, &info) != 0) {
+			std::cerr << "cannot open " << path << std::endl;
+			std::exit(-1);
+		}
+		size = info.st_size;
+		if (size) {
+			void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED) {
+				std::cerr << "cannot map " << path << std::endl;
+				std::exit(-1);
+			}
+			::madvise(map, size, MADV_SEQUENTIAL);
+			data = static_cast<const char*>(map);
+		}
+		::close(fd);
+	}
+	~logfile() {
+		if (data) ::munmap(const_cast<char*>(data), size);
+	}
+
+	/**
+	 * append the episodes of the log to 'stat'
+	 */
+	void load(statistic& stat) {
+		profiler::tick start = profiler::nanosec();
+		std::vector<std::vector<episode>> parts(threads);
+		std::vector<size_t> errors(threads);
+		std::vector<std::thread> workers;
+		for (size_t k = 0; k < threads; k++)
+			workers.emplace_back(&logfile::parse, this, boundary(size * k / threads), boundary(size * (k + 1) / threads),
+				std::ref(parts[k]), std::ref(errors[k]));
+		for (std::thread& t : workers) t.join();
+
+		std::rotate(stat.data.begin(), stat.data.begin() + stat.head, stat.data.end());
+		stat.head = 0;
+		for (size_t k = 0; k < threads; k++) {
+			for (episode& ep : parts[k]) stat.data.push_back(std::move(ep));
+			loaded += parts[k].size();
+			broken += errors[k];
+			std::vector<episode>().swap(parts[k]);
+		}
+		stat.total = std::max(stat.total, stat.data.size());
+		stat.count = stat.data.size();
+		if (!replay) stat.blank = stat.count;
+		elapsed = profiler::nanosec() - start;
+		if (broken) std::cerr << "skip " << broken << " malformed lines of " << path << std::endl;
+	}
+
+	/**
+	 * the format would be
+	 * load = stat.txt, 1204.5MB, 100000 episodes in 2.1s (573.6MB/s), 4 threads
+	 */
+	void report(std::ostream& out) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "load = " << path << ", " << std::fixed << std::setprecision(1) << (size * 1e-6) << "MB, ";
+		out << loaded << " episodes in " << (elapsed * 1e-9) << "s (" << (size * 1e3 / std::max(elapsed, profiler::tick(1))) << "MB/s), ";
+		out << threads << " threads" << (replay ? "" : ", no replay") << std::endl;
+		out.copyfmt(ff);
+	}
+
+protected:
+	/**
+	 * the first line which begins at or after the offset
+	 */
+	size_t boundary(size_t offset) const {
+		if (offset == 0 || offset >= size) return std::min(offset, size);
+		const char* p = static_cast<const char*>(std::memchr(data + offset - 1, '\n', size - offset + 1));
+		return p ? p - data + 1 : size;
+	}
+
+	void parse(size_t begin, size_t end, std::vector<episode>& part, size_t& errors) const {
+		episode ep; // keep the move buffer, and copy only the moves of each episode
+		for (const char* p = data + begin; p < data + end; ) {
+			const char* eol = static_cast<const char*>(std::memchr(p, '\n', data + end - p));
+			if (!eol) eol = data + end;
+			if (eol != p) {
+				if (ep.parse(p, eol, replay)) part.push_back(ep);
+				else errors++;
+			}
+			p = eol + 1;
+		}
+	}
+
+private:
+	std::string path;
+	size_t threads;
+	bool replay;
+	const char* data;
+	size_t size;
+	size_t loaded;
+	size_t broken;
+	profiler::tick elapsed;
+};
@@ -0,0 +1,262 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * metrics.h: Machine-readable export of the block statistics
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "board.h"
+#include "agent.h"
+#include "statistic.h"
+#include "profiler.h"
+
+/**
+ * a sink of the block records of a statistic
+ *
+ * every block is written as one line of JSON or CSV to a file, or to a local stream
+ * socket given as 'unix:path'; a socket that is not listening is retried at the next
+ * block, and a line that cannot be sent immediately is dropped, so training never waits
+ *
+ * optionally, the latest block is also written as a Prometheus text file, which is
+ * replaced by rename() so that a scraper never reads a partial file
+ */
+class metrics {
+public:
+	/**
+	 * the weights are surveyed every 'survey' blocks (never if 0), since a survey reads all the tables
+	 */
+	metrics(const std::string& sink, const std::string& format = "json", const std::string& prom = "",
+			const std::string& run = "", size_t survey = 0)
+		: sink(sink), format(format), prom(prom), run(run.size() ? run : std::to_string(::getpid())),
+		  survey(survey), blocks(0), fd(-1), lines(0) {
+		if (sink.size() && sink.find("unix:") != 0) {
+			file.open(sink, std::ios::out | std::ios::app);
+			if (!file.is_open()) {
+				std::cerr << "cannot open " << sink << std::endl;
+				std::exit(-1);
+			}
+			lines = file.tellp() ? 1 : 0; // the csv header is already there
+		}
+	}
+	~metrics() {
+		if (fd >= 0) ::close(fd);
+	}
+
+	/**
+	 * the fields of a record, in the order of the csv columns
+	 *
+	 * time, run, episodes, games, avg, max, ops, player_ops, env_ops,
+	 * reach_1, reach_2, ..., reach_75025 (the rate of reaching each tile),
+	 * slide_ns, slide_share, ..., other_ns, other_share (the profiler phases),
+	 * slide_llc-miss, ... (the hardware events per call of each phase, if enabled),
+	 * alpha, tables, entries,
+	 * nonzero, weight_rms, weight_max (the latest survey of the weights, if enabled)
+	 */
+	typedef std::vector<std::pair<std::string, std::string>> fields;
+
+	fields collect(const statistic::record& r, const player& play) const {
+		fields f;
+		auto add = [&](const std::string& key, double value) { f.emplace_back(key, real(value)); };
+		auto count = [&](const std::string& key, uint64_t value) { f.emplace_back(key, std::to_string(value)); };
+		count("time", std::time(nullptr));
+		f.emplace_back("run", run);
+		count("episodes", r.count);
+		count("games", r.games);
+		add("avg", r.avg());
+		count("max", r.max);
+		add("ops", r.ops());
+		add("player_ops", r.player_ops());
+		add("env_ops", r.env_ops());
+		for (unsigned t = 1; t < tiles; t++)
+			add("reach_" + std::to_string(board::fibonacci(t)), r.boards ? double(r.reach(t)) / r.boards : 0);
+		profiler::tick total = std::max(r.phase.total(), profiler::tick(1));
+		for (unsigned p = profiler::slide, n = 0; n < profiler::phases; p = (p + 1) % profiler::phases, n++) {
+			add(std::string(profiler::name(p)) + "_ns", r.phase.calls[p] ? double(r.phase.time[p]) / r.phase.calls[p] : 0);
+			add(std::string(profiler::name(p)) + "_share", double(r.phase.time[p]) / total);
+			for (unsigned e : profiler::available())
+				add(std::string(profiler::name(p)) + "_" + profiler::event_name(e), double(r.phase.count[p][e]) / std::max(r.phase.calls[p], profiler::tick(1)));
+		}
+		add("alpha", play.learning_rate());
+		size_t entries = 0;
+		for (const weight& w : play.weights()) entries += w.size();
+		count("tables", play.weights().size());
+		count("entries", entries);
+		f.insert(f.end(), surveyed.begin(), surveyed.end());
+		return f;
+	}
+
+	/**
+	 * the statistics of all the weights, which walks through every table
+	 */
+	static fields inspect(const player& play) {
+		size_t entries = 0, nonzero = 0;
+		double square = 0, max = 0;
+		for (const weight& w : play.weights()) {
+			const weight::type* v = w.size() ? &w[0] : nullptr;
+			for (size_t i = 0, n = w.size(); i < n; i++) {
+				nonzero += (v[i] != 0);
+				square += double(v[i]) * v[i];
+				max = std::max(max, double(std::abs(v[i])));
+			}
+			entries += w.size();
+		}
+		fields f;
+		f.emplace_back("nonzero", std::to_string(nonzero));
+		f.emplace_back("weight_rms", real(entries ? std::sqrt(square / entries) : 0));
+		f.emplace_back("weight_max", real(max));
+		return f;
+	}
+
+	/**
+	 * a real value in the fixed notation, so that no digit is lost to an exponent
+	 * the integral fields are written as integers instead
+	 */
+	static std::string real(double value) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(9) << (std::isfinite(value) ? value : 0);
+		return ss.str();
+	}
+
+	/**
+	 * write a block record to the sink and the Prometheus file
+	 */
+	void emit(const statistic::record& r, const player& play) {
+		if (survey && blocks++ % survey == 0) surveyed = inspect(play);
+		fields f = collect(r, play);
+		std::stringstream line;
+		if (format == "csv") {
+			if (lines++ == 0) {
+				for (size_t i = 0; i < f.size(); i++) line << (i ? "," : "") << f[i].first;
+				line << std::endl;
+			}
+			for (size_t i = 0; i < f.size(); i++) line << (i ? "," : "") << f[i].second;
+		} else {
+			line << "{";
+			for (size_t i = 0; i < f.size(); i++) {
+				bool text = f[i].first == "run";
+				line << (i ? "," : "") << "\"" << f[i].first << "\":";
+				line << (text ? "\"" : "") << f[i].second << (text ? "\"" : "");
+			}
+			line << "}";
+		}
+		line << std::endl;
+		if (file.is_open()) {
+			file << line.str() << std::flush;
+		} else if (sink.size()) {
+			send(line.str());
+		}
+		if (prom.size()) expose(f);
+	}
+
+protected:
+	/**
+	 * write the fields in the Prometheus text format, e.g.,
+	 * tcg_avg{run="1234"} 52342
+	 * tcg_reach{run="1234",tile="2584"} 0.31
+	 * tcg_phase_ns{run="1234",phase="lookup"} 240
+	 * tcg_phase_events{run="1234",phase="lookup",event="llc_miss"} 8.2
+	 */
+	void expose(const fields& f) {
+		std::stringstream out;
+		std::string label = "run=\"" + run + "\"";
+		for (auto& kv : f) {
+			const std::string& key = kv.first;
+			if (key == "run") continue;
+			std::string name = "tcg_" + key, extra, phase, kind;
+			for (char& c : name) if (!std::isalnum(c) && c != '_' && c != ':') c = '_';
+			if (event(key, phase, kind)) {
+				name = "tcg_phase_events";
+				extra = ",phase=\"" + phase + "\",event=\"" + kind + "\"";
+			} else if (key.find("reach_") == 0) {
+				name = "tcg_reach";
+				extra = ",tile=\"" + key.substr(6) + "\"";
+			} else if (suffix(key, "_ns")) {
+				name = "tcg_phase_ns";
+				extra = ",phase=\"" + key.substr(0, key.size() - 3) + "\"";
+			} else if (suffix(key, "_share")) {
+				name = "tcg_phase_share";
+				extra = ",phase=\"" + key.substr(0, key.size() - 6) + "\"";
+			}
+			out << name << "{" << label << extra << "} " << kv.second << std::endl;
+		}
+		std::string temp = prom + ".tmp";
+		std::ofstream file(temp, std::ios::out | std::ios::trunc);
+		file << out.str();
+		file.close();
+		if (!file || std::rename(temp.c_str(), prom.c_str()) != 0)
+			std::cerr << "cannot write " << prom << std::endl;
+	}
+
+	/**
+	 * whether the key is '<phase>_<event>', the hardware events per call of a phase,
+	 * where the event is taken with '_' in place of '-', e.g., 'llc_miss'
+	 */
+	static bool event(const std::string& key, std::string& phase, std::string& kind) {
+		for (unsigned p = 0; p < profiler::phases; p++) {
+			for (unsigned e = 0; e < profiler::events; e++) {
+				if (key != std::string(profiler::name(p)) + "_" + profiler::event_name(e)) continue;
+				phase = profiler::name(p);
+				kind = profiler::event_name(e);
+				std::replace(kind.begin(), kind.end(), '-', '_');
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool suffix(const std::string& key, const std::string& end) {
+		return key.size() > end.size() && key.compare(key.size() - end.size(), end.size(), end) == 0;
+	}
+
+	void send(const std::string& line) {
+		if (fd < 0) {
+			std::string path = sink.substr(5);
+			sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+			path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+			fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+				::close(fd);
+				fd = -1;
+			}
+			if (fd < 0) return;
+		}
+		ssize_t n = ::send(fd, line.data(), line.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; // the listener is slow, drop this line
+		if (n != ssize_t(line.size())) { // the listener is gone, or a partial line is sent
+			::close(fd); // reconnect at the next block
+			fd = -1;
+		}
+	}
+
+private:
+	static constexpr unsigned tiles = 25;
+	std::string sink;
+	std::string format;
+	std::string prom;
+	std::string run;
+	size_t survey;
+	size_t blocks;
+	fields surveyed;
+	std::ofstream file;
+	int fd;
+	size_t lines;
+};
@@ -0,0 +1,224 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * pipeline.h: Actor-learner training pipeline with lock-free episode queues
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+
+/**
+ * bounded single-producer single-consumer ring
+ * items are swapped in and out, so their buffers are recycled between both ends
+ */
+template<typename type>
+class spsc_queue {
+public:
+	spsc_queue(size_t capacity) : ring(round_up(capacity)), head(0), tail(0) {}
+
+	/**
+	 * called by the producer only, return false if the ring is full
+	 */
+	bool push(type& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == ring.size()) return false;
+		std::swap(ring[t & (ring.size() - 1)], item);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * called by the consumer only, return false if the ring is empty
+	 */
+	bool pop(type& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		std::swap(item, ring[h & (ring.size() - 1)]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+	size_t capacity() const { return ring.size(); }
+
+private:
+	static size_t round_up(size_t n) {
+		size_t p = 1;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+	std::vector<type> ring;
+	char pad0[64];
+	std::atomic<size_t> head;
+	char pad1[64];
+	std::atomic<size_t> tail;
+	char pad2[64];
+};
+
+/**
+ * actor-learner training
+ *
+ * actors play with the current weights and push their afterstate trajectories into
+ * one queue per actor; learners drain the queues of their own actors and run the TD
+ * backward pass. the weight tables are shared without locking, so an actor may read
+ * a table while a learner is updating it, which is tolerated as in lock-free SGD
+ *
+ * an actor blocks when its queue is full (backpressure); the staleness of a trajectory
+ * is the number of updated episodes between its start and its learning
+ */
+class pipeline {
+public:
+	pipeline(player& play, const std::string& evil_args, size_t actors, size_t learners, size_t capacity)
+		: play(play), evil_args(evil_args), actors(std::max(actors, size_t(1))),
+		  learners(std::max(std::min(learners, actors), size_t(1))), issued(0), finished(0), updates(0),
+		  stalls(0), stale_sum(0), stale_max(0), stale_count(0) {
+		for (size_t i = 0; i < this->actors; i++) queues.emplace_back(new spsc_queue<trajectory>(capacity));
+	}
+
+	/**
+	 * run the remaining episodes of 'stat'
+	 * the pipeline report is attached to 'stat', so the pipeline should outlive it
+	 */
+	void run(statistic& stat) {
+		size_t games = stat.remaining();
+		stat.attach([this](std::ostream& out) { report(out); });
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < actors; i++)
+			threads.emplace_back(&pipeline::actor, this, i, games, std::ref(stat));
+		for (size_t i = 0; i < learners; i++)
+			threads.emplace_back(&pipeline::learner, this, i);
+		for (std::thread& t : threads) t.join();
+	}
+
+	/**
+	 * the format would be
+	 * pipeline = queue 12/256, stall 3, staleness 4.2 (max 17)
+	 *
+	 * where 'queue' is the trajectories waiting for learners over the total capacity,
+	 * 'stall' is the number of times an actor found its queue full since the last report,
+	 * and 'staleness' is the average (and max) staleness since the last report
+	 */
+	void report(std::ostream& out) {
+		size_t size = 0, capacity = 0;
+		for (auto& q : queues) size += q->size(), capacity += q->capacity();
+		size_t count = stale_count.exchange(0), sum = stale_sum.exchange(0), max = stale_max.exchange(0);
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "pipeline = queue " << size << "/" << capacity << ", stall " << stalls.exchange(0);
+		out << ", staleness " << std::fixed << std::setprecision(1) << (count ? double(sum) / count : 0);
+		out << " (max " << max << ")" << std::endl;
+		out.copyfmt(ff);
+	}
+
+protected:
+	struct trajectory {
+		std::vector<player::step> history;
+		size_t version;
+		trajectory() : version(0) {}
+	};
+
+	void actor(size_t id, size_t games, statistic& stat) {
+		rndenv evil(evil_args + seed_args(id));
+		episode game;
+		trajectory traj;
+		std::string flag = play.name() + ":" + evil.name();
+		while (issued.fetch_add(1) < games) {
+			traj.history.clear();
+			traj.version = updates.load(std::memory_order_relaxed);
+			game.clear();
+			game.open_episode(flag);
+			evil.open_episode(play.name() + ":~");
+			while (true) {
+				agent& who = game.take_turns(play, evil);
+				action move;
+				if (&who == &play) {
+					player::step best;
+					int op = play.select_action(game.state(), best);
+					if (op != -1) traj.history.push_back(best);
+					move = action::slide(op);
+				} else {
+					move = who.take_action(game.state());
+				}
+				if (game.apply_action(move) != true) break;
+				if (who.check_for_win(game.state())) break;
+			}
+			agent& win = game.last_turns(play, evil);
+			game.close_episode(win.name());
+			evil.close_episode(win.name());
+			{
+				std::lock_guard<std::mutex> lock(record);
+				stat.push(game);
+			}
+			while (!queues[id]->push(traj)) {
+				stalls.fetch_add(1, std::memory_order_relaxed);
+				while (queues[id]->size() == queues[id]->capacity()) std::this_thread::yield();
+			}
+		}
+		finished.fetch_add(1);
+	}
+
+	void learner(size_t id) {
+		trajectory traj;
+		while (true) {
+			bool idle = true, done = finished.load() == actors;
+			for (size_t i = id; i < actors; i += learners) {
+				if (!queues[i]->pop(traj)) continue;
+				size_t stale = updates.load(std::memory_order_relaxed) - traj.version;
+				stale_sum.fetch_add(stale, std::memory_order_relaxed);
+				stale_count.fetch_add(1, std::memory_order_relaxed);
+				size_t max = stale_max.load(std::memory_order_relaxed);
+				while (stale > max && !stale_max.compare_exchange_weak(max, stale));
+				play.learn(traj.history);
+				updates.fetch_add(1, std::memory_order_relaxed);
+				idle = false;
+			}
+			if (idle && done) break;
+			if (idle) std::this_thread::yield();
+		}
+	}
+
+	/**
+	 * derive a distinct environment seed for each actor, if a seed is given
+	 */
+	std::string seed_args(size_t id) const {
+		std::stringstream ss(evil_args);
+		for (std::string pair; ss >> pair; ) {
+			if (pair.find("seed=") == 0)
+				return " seed=" + std::to_string(std::stoull(pair.substr(5)) + id);
+		}
+		return " seed=" + std::to_string(std::random_device()() + id);
+	}
+
+private:
+	player& play;
+	std::string evil_args;
+	size_t actors;
+	size_t learners;
+	std::vector<std::unique_ptr<spsc_queue<trajectory>>> queues;
+	std::mutex record;
+
+	std::atomic<size_t> issued;
+	std::atomic<size_t> finished;
+	std::atomic<size_t> updates;
+	std::atomic<size_t> stalls;
+	std::atomic<size_t> stale_sum;
+	std::atomic<size_t> stale_max;
+	std::atomic<size_t> stale_count;
+};
@@ -0,0 +1,364 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * profiler.h: Per-phase timing instrumentation for the game loop
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * phase accumulators with nanosecond resolution
+ *
+ * each thread keeps its own counters; time is charged exclusively to the innermost
+ * active phase, so a phase nested in another one (e.g., lookups during a TD update)
+ * is not counted twice
+ *
+ * the timing is off unless enabled (e.g., by '--profile'), so that a scope costs a single
+ * predictable branch; once enabled, the counters run on the TSC when available (a few
+ * cycles per switch), and are converted to nanoseconds with steady_clock when collected
+ * define NPROFILE to compile the scopes out entirely
+ *
+ * optionally, hardware events (cache and TLB misses, branch mispredictions, ...) are
+ * counted per phase with perf_event_open, read by rdpmc when the kernel allows it or
+ * by read() otherwise; the events that cannot be opened (e.g., in a container) are
+ * skipped, and the timing works as usual
+ *
+ * usage:
+ *  { profiler::scope s(profiler::lookup); ... } // charge this block to 'lookup'
+ *  profiler::report r = profiler::collect(); // totals of all threads so far
+ */
+class profiler {
+public:
+	enum phase { other, slide, feature, lookup, environment, update, phases };
+	typedef uint64_t tick;
+
+	enum event { llc_miss, dtlb_miss, branch_miss, instruction, page_fault, events };
+
+	static const char* name(unsigned p) {
+		static const char* names[] = { "other", "slide", "feature", "lookup", "env", "update" };
+		return p < phases ? names[p] : "?";
+	}
+	static const char* event_name(unsigned e) {
+		static const char* names[] = { "llc-miss", "dtlb-miss", "br-miss", "insn", "fault" };
+		return e < events ? names[e] : "?";
+	}
+
+	/**
+	 * enable the phase timing, before the threads which run the scopes are started
+	 */
+	static void enable() { switched() = true; }
+	static bool enabled() { return switched(); }
+
+	/**
+	 * enable the event counters (and the timing) for the threads started afterwards,
+	 * including the calling one; return the events that can be opened, and report the others to 'log'
+	 */
+	static std::vector<unsigned> hardware(std::ostream& log = std::cerr) {
+		enable();
+		registry().sampling = true;
+		std::vector<unsigned> opened;
+		sampler probe;
+		probe.open();
+		for (unsigned e = 0; e < events; e++) {
+			if (probe.fd[e] >= 0) opened.push_back(e);
+			else log << "perf event " << event_name(e) << " is unavailable: " << probe.error[e] << std::endl;
+		}
+		registry().available = opened;
+		return opened;
+	}
+	static const std::vector<unsigned>& available() { return registry().available; }
+
+	static tick nanosec() {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+	static tick cycle() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return nanosec();
+#endif
+	}
+
+	/**
+	 * charge the lifetime of this object to the given phase
+	 */
+	class scope {
+	public:
+#ifndef NPROFILE
+		scope(phase p) : on(enabled()), prev(on ? local().enter(p, true) : p) {}
+		~scope() { if (on) local().enter(prev, false); }
+		void shift(phase p) { if (on) local().enter(p, true); } // continue with another phase
+#else
+		scope(phase p) : on(false), prev(p) {}
+		void shift(phase p) {}
+#endif
+	private:
+		bool on;
+		phase prev;
+	};
+
+	/**
+	 * the accumulated time (ns) and entry count of each phase
+	 */
+	struct report {
+		std::array<tick, phases> time;
+		std::array<tick, phases> calls;
+		std::array<std::array<tick, events>, phases> count; // the hardware events
+		report() : time(), calls(), count() {}
+
+		tick total() const { return std::accumulate(time.begin(), time.end(), tick(0)); }
+		report operator -(const report& r) const {
+			report d;
+			for (unsigned p = 0; p < phases; p++) {
+				d.time[p] = time[p] > r.time[p] ? time[p] - r.time[p] : 0; // the calibration may drift slightly
+				d.calls[p] = calls[p] - r.calls[p];
+				for (unsigned e = 0; e < events; e++) d.count[p][e] = count[p][e] > r.count[p][e] ? count[p][e] - r.count[p][e] : 0;
+			}
+			return d;
+		}
+
+		/**
+		 * the format would be
+		 * perf = llc-miss/dtlb-miss/br-miss per call: slide 0.0/0.0/2.1, feature 0.0/0.1/0.0, lookup 8.2/3.1/0.0, ...
+		 *
+		 * where the events are listed only if available, and 'other' is listed at last
+		 */
+		void print_events(std::ostream& out) const {
+			const std::vector<unsigned>& list = available();
+			std::ios ff(nullptr);
+			ff.copyfmt(out);
+			out << "perf = ";
+			for (size_t k = 0; k < list.size(); k++) out << (k ? "/" : "") << event_name(list[k]);
+			out << " per call: " << std::fixed << std::setprecision(1);
+			for (unsigned p = phase::slide, n = 0; p <= phases; p++, n++) {
+				unsigned i = p % phases;
+				out << (n ? ", " : "") << name(i) << " ";
+				for (size_t k = 0; k < list.size(); k++)
+					out << (k ? "/" : "") << (double(count[i][list[k]]) / std::max(calls[i], tick(1)));
+			}
+			out.copyfmt(ff);
+		}
+
+		/**
+		 * the format would be
+		 * phase = slide 35ns (4.1%), feature 96ns (22.5%), lookup 240ns (56.3%), ...
+		 *
+		 * where each entry is the average time per entry and the share of the total
+		 * the time outside any phase is listed as 'other', without an average
+		 */
+		friend std::ostream& operator <<(std::ostream& out, const report& r) {
+			tick sum = std::max(r.total(), tick(1));
+			std::ios ff(nullptr);
+			ff.copyfmt(out);
+			out << "phase = ";
+			for (unsigned p = phase::slide, n = 0; p <= phases; p++, n++) {
+				unsigned i = p % phases; // list 'other' at last
+				if (n) out << ", ";
+				out << name(i) << " " << std::fixed << std::setprecision(0);
+				if (r.calls[i]) out << (double(r.time[i]) / r.calls[i]) << "ns ";
+				out << "(" << std::setprecision(1) << (r.time[i] * 100.0 / sum) << "%)";
+			}
+			out.copyfmt(ff);
+			return out;
+		}
+	};
+
+	/**
+	 * sum up the counters of all threads, including the finished ones
+	 */
+	static report collect() {
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		report r = registry().retired;
+		for (counter* c : registry().active) c->dump(r);
+		double scale = double(nanosec() - registry().origin.first) / std::max(cycle() - registry().origin.second, tick(1));
+		for (tick& t : r.time) t *= scale;
+		return r;
+	}
+
+private:
+	/**
+	 * the event counters of a thread
+	 */
+	struct sampler {
+		std::array<int, events> fd;
+		std::array<std::string, events> error;
+		std::array<void*, events> page; // the perf_event_mmap_page of each event
+		std::array<tick, events> last;
+		bool any;
+
+		sampler() : any(false) {
+			fd.fill(-1);
+			page.fill(nullptr);
+			last.fill(0);
+		}
+		~sampler() {
+#ifdef __linux__
+			for (unsigned e = 0; e < events; e++) {
+				if (page[e]) ::munmap(page[e], ::sysconf(_SC_PAGESIZE));
+				if (fd[e] >= 0) ::close(fd[e]);
+			}
+#endif
+		}
+
+		void open() {
+#ifdef __linux__
+			static const std::pair<uint32_t, uint64_t> config[] = {
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+				{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+				{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+				{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+			};
+			for (unsigned e = 0; e < events; e++) {
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = config[e].first;
+				attr.config = config[e].second;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				fd[e] = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+				if (fd[e] < 0) {
+					error[e] = std::strerror(errno);
+					continue;
+				}
+				void* map = ::mmap(nullptr, ::sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd[e], 0);
+				if (map != MAP_FAILED) page[e] = map;
+				last[e] = read(e);
+				any = true;
+			}
+#else
+			error.fill("not supported");
+#endif
+		}
+
+		/**
+		 * read an event with rdpmc if the kernel allows it in user space, or with read() otherwise
+		 */
+		tick read(unsigned e) const {
+#ifdef __linux__
+#if defined(__x86_64__) || defined(__i386__)
+			if (const perf_event_mmap_page* pc = static_cast<const perf_event_mmap_page*>(page[e])) {
+				uint32_t seq, index;
+				uint64_t value;
+				do {
+					seq = pc->lock;
+					__atomic_signal_fence(__ATOMIC_SEQ_CST);
+					index = pc->index;
+					value = pc->offset;
+					if (!pc->cap_user_rdpmc || !index) break;
+					uint64_t pmc = __rdpmc(index - 1);
+					value += (pmc << (64 - pc->pmc_width)) >> (64 - pc->pmc_width);
+					__atomic_signal_fence(__ATOMIC_SEQ_CST);
+				} while (pc->lock != seq);
+				if (pc->cap_user_rdpmc && index) return value;
+			}
+#endif
+			uint64_t value = 0;
+			return ::read(fd[e], &value, sizeof(value)) == sizeof(value) ? value : last[e];
+#else
+			return 0;
+#endif
+		}
+	};
+
+	struct counter {
+		std::array<std::atomic<tick>, phases> time;
+		std::array<std::atomic<tick>, phases> calls;
+		std::array<std::array<std::atomic<tick>, events>, phases> count;
+		phase current;
+		tick last;
+		sampler perf;
+
+		counter() : current(other), last(cycle()) {
+			for (auto& t : time) t.store(0, std::memory_order_relaxed);
+			for (auto& n : calls) n.store(0, std::memory_order_relaxed);
+			for (auto& p : count) for (auto& n : p) n.store(0, std::memory_order_relaxed);
+			if (registry().sampling) perf.open();
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().active.push_back(this);
+		}
+		~counter() {
+			enter(other, false);
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			dump(registry().retired);
+			auto& active = registry().active;
+			active.erase(std::find(active.begin(), active.end(), this));
+		}
+
+		/**
+		 * switch to another phase, return the previous one
+		 * 'entry' is false when resuming an outer phase, which should not count as a new entry
+		 * the counters are only written by the owner thread, so no atomic rmw is needed
+		 */
+		phase enter(phase next, bool entry) {
+			tick now = cycle();
+			time[current].store(time[current].load(std::memory_order_relaxed) + (now - last), std::memory_order_relaxed);
+			if (entry) calls[next].store(calls[next].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (perf.any) sample();
+			phase prev = current;
+			current = next;
+			last = now;
+			return prev;
+		}
+
+		/**
+		 * charge the events since the last switch to the current phase
+		 */
+		void sample() {
+			for (unsigned e = 0; e < events; e++) {
+				if (perf.fd[e] < 0) continue;
+				tick now = perf.read(e);
+				count[current][e].store(count[current][e].load(std::memory_order_relaxed) + (now - perf.last[e]), std::memory_order_relaxed);
+				perf.last[e] = now;
+			}
+		}
+
+		void dump(report& r) const {
+			for (unsigned p = 0; p < phases; p++) {
+				r.time[p] += time[p].load(std::memory_order_relaxed);
+				r.calls[p] += calls[p].load(std::memory_order_relaxed);
+				for (unsigned e = 0; e < events; e++) r.count[p][e] += count[p][e].load(std::memory_order_relaxed);
+			}
+		}
+	};
+
+	struct table {
+		std::mutex mutex;
+		std::vector<counter*> active;
+		report retired;
+		std::pair<tick, tick> origin; // (nanosec, cycle) for calibration
+		std::atomic<bool> sampling; // open the event counters in new threads
+		std::vector<unsigned> available;
+		table() : origin(nanosec(), cycle()), sampling(false) {}
+	};
+
+	static table& registry() { static table t; return t; }
+	static bool& switched() { static bool on = false; return on; }
+	static counter& local() { static thread_local counter c; return c; }
+};
@@ -0,0 +1,130 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * replay.h: Offline training from recorded episode logs
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistic.h"
+
+/**
+ * replay the episodes saved by '--save' and learn from their afterstates
+ *
+ * the logs are split into chunks of whole lines, which are processed by several threads;
+ * each episode is rebuilt by applying its actions, and its afterstates are passed to the
+ * same TD backward pass as a live game. the weight tables are shared without locking
+ */
+class replay {
+public:
+	replay(player& play, const std::vector<std::string>& paths, size_t threads, size_t chunk = 64 << 20)
+		: play(play), threads(std::max(threads, size_t(1))), next(0),
+		  learn([&play](const std::vector<player::step>& history) { play.learn(history); }) {
+		for (const std::string& path : paths) {
+			std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+			if (!in.is_open()) {
+				std::cerr << "cannot open " << path << std::endl;
+				std::exit(-1);
+			}
+			size_t size = in.tellg();
+			for (size_t begin = 0; begin < size; begin += chunk)
+				chunks.push_back({ path, begin, std::min(begin + chunk, size), 0 });
+		}
+	}
+
+	/**
+	 * learn all the episodes, and record them into 'stat' for the block reports
+	 */
+	void run(statistic& stat) {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < threads; i++)
+			workers.emplace_back(&replay::worker, this, std::ref(stat));
+		for (std::thread& t : workers) t.join();
+		for (size_t i = 0, broken = 0; i < chunks.size(); i++) {
+			broken += chunks[i].broken;
+			if (i + 1 < chunks.size() && chunks[i + 1].path == chunks[i].path) continue;
+			if (broken) std::cerr << "skip " << broken << " malformed lines of " << chunks[i].path << std::endl;
+			broken = 0;
+		}
+	}
+
+	/**
+	 * pass the afterstates of each episode to 'fit' instead of the TD backward pass of the player
+	 * 'fit' is called by several threads at once
+	 */
+	void learn_with(const std::function<void(const std::vector<player::step>&)>& fit) {
+		learn = fit;
+	}
+
+	/**
+	 * rebuild the afterstates of the player from the recorded actions
+	 */
+	static void afterstates(const episode& ep, std::vector<player::step>& history) {
+		history.clear();
+		board state;
+		for (const action& move : ep.actions()) {
+			board::reward reward = move.apply(state);
+			if (reward == -1) break;
+			if (move.type() == action::slide::type) history.push_back({ reward, state });
+		}
+	}
+
+protected:
+	struct chunk {
+		std::string path;
+		size_t begin;
+		size_t end;
+		size_t broken; // the lines which cannot be parsed, and are skipped
+	};
+
+	/**
+	 * a line belongs to the chunk where it begins
+	 */
+	void worker(statistic& stat) {
+		episode ep;
+		std::vector<player::step> history;
+		for (size_t i; (i = next.fetch_add(1)) < chunks.size(); ) {
+			chunk& c = chunks[i];
+			std::ifstream in(c.path, std::ios::in | std::ios::binary);
+			std::string line;
+			if (c.begin) {
+				in.seekg(c.begin - 1);
+				std::getline(in, line); // the rest of the previous chunk
+			}
+			while (size_t(in.tellg()) < c.end && std::getline(in, line)) {
+				if (line.empty()) continue;
+				if (!ep.parse(line.data(), line.data() + line.size())) {
+					c.broken++;
+					continue;
+				}
+				afterstates(ep, history);
+				learn(history);
+				std::lock_guard<std::mutex> lock(record);
+				stat.push(ep);
+			}
+		}
+	}
+
+private:
+	player& play;
+	size_t threads;
+	std::vector<chunk> chunks;
+	std::atomic<size_t> next;
+	std::mutex record;
+	std::function<void(const std::vector<player::step>&)> learn;
+};
@@ -0,0 +1,236 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * search.h: Parallel search over candidate feature combinations
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <thread>
+#include <memory>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <time.h>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+
+/**
+ * train and compare several candidate players, e.g., with different 'tuple=' sets
+ *
+ * each candidate is trained by its own group of threads for 'budget' episodes, split into
+ * rounds; the i-th training episode of every candidate uses the same environment seed.
+ * after each round, all the remaining candidates are evaluated on the same seeded games
+ * without learning, and a candidate is eliminated if it is clearly losing, i.e., the upper
+ * bound of its average score (mean + 2 standard errors) is below the lower bound of the best
+ */
+class search {
+public:
+	search(const std::vector<std::string>& candidates, const std::string& evil_args,
+			size_t budget, size_t rounds, size_t games, size_t group, unsigned goal)
+		: budget(budget), rounds(std::max(rounds, size_t(1))), games(std::max(games, size_t(1))),
+		  group(std::max(group, size_t(1))), goal(board::index(goal)), seed(std::random_device()()) {
+		std::stringstream ss(evil_args);
+		for (std::string pair; ss >> pair; ) {
+			if (pair.find("seed=") == 0) seed = std::stoul(pair.substr(5));
+		}
+		for (size_t i = 0; i < candidates.size(); i++) {
+			std::string args = candidates[i];
+			if (args.find("name=") == std::string::npos) args = "name=" + std::to_string(i + 1) + " " + args;
+			entries.emplace_back(new candidate(args));
+		}
+	}
+
+	/**
+	 * read the candidates from a file, one line of player arguments per candidate
+	 * empty lines and lines starting with '#' are ignored
+	 */
+	static std::vector<std::string> candidates(const std::string& path, const std::string& common = "") {
+		std::ifstream in(path, std::ios::in);
+		if (!in.is_open()) {
+			std::cerr << "cannot open " << path << std::endl;
+			std::exit(-1);
+		}
+		std::vector<std::string> list;
+		for (std::string line; std::getline(in, line); ) {
+			if (line.empty() || line[0] == '#') continue;
+			list.push_back(common + " " + line);
+		}
+		return list;
+	}
+
+	/**
+	 * the format would be
+	 * round 1/4: 2500 episodes, 5 candidates
+	 *         6-tuple    avg = 52342 (se 812), 2584 = 31.0%, cpu = 62.3s
+	 *         4-tuple    avg = 20113 (se 402), 2584 = 0.0%, cpu = 21.7s, eliminated
+	 * ...
+	 * rank    name       avg     max     2584    cpu     score/cpu   round
+	 * 1       6-tuple    98431   251347  72.0%   250.1   393.6       4
+	 *
+	 * where 'se' is the standard error of the average, '2584' is the rate of reaching the goal tile 2584,
+	 * 'cpu' is the training time in CPU seconds, 'score/cpu' is the average score per CPU second,
+	 * and 'round' is the last round of the candidate
+	 */
+	void run(std::ostream& out) {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed;
+		for (size_t r = 1, first = 0; r <= rounds; r++) {
+			size_t count = budget * r / rounds - first;
+			std::vector<candidate*> alive;
+			for (auto& c : entries) if (c->play) alive.push_back(c.get());
+			out << "round " << r << "/" << rounds << ": " << count << " episodes, " << alive.size() << " candidates" << std::endl;
+
+			std::vector<std::thread> threads;
+			for (candidate* c : alive) threads.emplace_back(&search::train, this, c, first, count);
+			for (std::thread& t : threads) t.join();
+			threads.clear();
+			for (candidate* c : alive) threads.emplace_back(&search::evaluate, this, c);
+			for (std::thread& t : threads) t.join();
+			first += count;
+
+			double best = -1;
+			for (candidate* c : alive) best = std::max(best, c->mean() - 2 * c->error());
+			for (candidate* c : alive) {
+				c->round = r;
+				out << "\t" << std::left << std::setw(10) << c->name << std::right;
+				out << " avg = " << std::setprecision(0) << c->mean() << " (se " << c->error() << ")";
+				out << ", " << board::fibonacci(goal) << " = " << std::setprecision(1) << (c->rate(goal) * 100) << "%";
+				out << ", cpu = " << c->cpu << "s";
+				if (r < rounds && alive.size() > 1 && c->mean() + 2 * c->error() < best) {
+					c->play.reset(); // release the tables for the remaining candidates
+					out << ", eliminated";
+				}
+				out << std::endl;
+			}
+		}
+
+		std::vector<candidate*> rank;
+		for (auto& c : entries) rank.push_back(c.get());
+		std::stable_sort(rank.begin(), rank.end(), [](candidate* a, candidate* b) {
+			return a->round != b->round ? a->round > b->round : a->mean() > b->mean();
+		});
+		out << std::endl << "rank\t" << std::left << std::setw(10) << "name" << std::right << "\tavg\tmax\t";
+		out << board::fibonacci(goal) << "\tcpu\tscore/cpu\tround" << std::endl;
+		for (size_t i = 0; i < rank.size(); i++) {
+			candidate* c = rank[i];
+			out << (i + 1) << "\t" << std::left << std::setw(10) << c->name << std::right;
+			out << "\t" << std::setprecision(0) << c->mean() << "\t" << c->max();
+			out << "\t" << std::setprecision(1) << (c->rate(goal) * 100) << "%\t" << c->cpu;
+			out << "\t" << (c->mean() / std::max(c->cpu, 1e-9)) << "\t" << c->round << std::endl;
+		}
+		out.copyfmt(ff);
+	}
+
+	/**
+	 * play an episode with an environment of the given seed, and learn from it if required
+	 * return the score and the largest tile
+	 */
+	static std::pair<board::reward, unsigned> play(player& play, unsigned seed, bool learn) {
+		rndenv evil("seed=" + std::to_string(seed));
+		episode game;
+		std::vector<player::step> history;
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			action move;
+			if (&who == &play) {
+				player::step best;
+				int op = play.select_action(game.state(), best);
+				if (op != -1 && learn) history.push_back(best);
+				move = action::slide(op);
+			} else {
+				move = who.take_action(game.state());
+			}
+			if (game.apply_action(move) != true) break;
+		}
+		if (learn) play.learn(history);
+		const board& state = game.state();
+		return { game.score(), *std::max_element(&state(0), &state(16)) };
+	}
+
+protected:
+	struct candidate {
+		std::string name;
+		std::unique_ptr<player> play;
+		std::vector<board::reward> score;
+		std::vector<unsigned> tile;
+		double cpu;
+		size_t round;
+
+		candidate(const std::string& args) : play(new player("init " + args)), cpu(0), round(0) {
+			name = play->name();
+		}
+		double mean() const {
+			return score.size() ? std::accumulate(score.begin(), score.end(), 0.0) / score.size() : 0;
+		}
+		double error() const {
+			double m = mean(), sq = 0;
+			for (board::reward s : score) sq += (s - m) * (s - m);
+			return score.size() > 1 ? std::sqrt(sq / (score.size() - 1) / score.size()) : 0;
+		}
+		board::reward max() const {
+			return score.size() ? *std::max_element(score.begin(), score.end()) : 0;
+		}
+		double rate(unsigned goal) const {
+			size_t n = std::count_if(tile.begin(), tile.end(), [=](unsigned t) { return t >= goal; });
+			return tile.size() ? double(n) / tile.size() : 0;
+		}
+	};
+
+	/**
+	 * train a candidate with episodes [first, first + count), shared by the threads of its group
+	 */
+	void train(candidate* c, size_t first, size_t count) {
+		std::vector<std::thread> threads;
+		std::vector<double> cpu(group);
+		for (size_t g = 0; g < group; g++) {
+			threads.emplace_back([=, &cpu]() {
+				double start = thread_cpu();
+				for (size_t i = first + g; i < first + count; i += group)
+					play(*c->play, seed + i, true);
+				cpu[g] = thread_cpu() - start;
+			});
+		}
+		for (std::thread& t : threads) t.join();
+		c->cpu += std::accumulate(cpu.begin(), cpu.end(), 0.0);
+	}
+
+	/**
+	 * evaluate a candidate with the same seeded games as the others, which are not used in training
+	 */
+	void evaluate(candidate* c) {
+		c->score.clear();
+		c->tile.clear();
+		for (size_t i = 0; i < games; i++) {
+			auto result = play(*c->play, seed + budget + i, false);
+			c->score.push_back(result.first);
+			c->tile.push_back(result.second);
+		}
+	}
+
+	static double thread_cpu() {
+		timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+private:
+	size_t budget;
+	size_t rounds;
+	size_t games;
+	size_t group;
+	unsigned goal;
+	unsigned seed;
+	std::vector<std::unique_ptr<candidate>> entries;
+};
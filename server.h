@@ -0,0 +1,324 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * server.h: Long-running move server with batched requests
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "board.h"
+#include "agent.h"
+#include "weightio.h"
+#include "profiler.h"
+
+/**
+ * answer requests with a network that is loaded once
+ *
+ * the requests are lines over stdin/stdout or a local stream socket ('unix:path'),
+ * and are answered in order for each connection
+ *  'move <16 tiles>'  → '<op> <reward> <value>', the best slide (-1 if none), its reward
+ *                       and the value of its afterstate; the command may be omitted
+ *  'value <16 tiles>' → '<value>', the value of the board as an afterstate
+ *  'reload <path>'    → 'ok' once the weights in 'path' are in use, or 'error' if 'path'
+ *                       is not a whole weight file of the same tables (the old ones stay)
+ *  'stats'            → 'n <requests> batch <avg> p50 <us> p99 <us> max <us>'
+ * where the tiles are the values in row-major order, e.g., '0 1 2 0 3 5 ...'
+ *
+ * the requests of all connections are queued, and one evaluator takes all the queued
+ * requests as a batch, takes the current network once for the batch, and answers them
+ * one by one; the reloads are queued for one reloader, which builds each new network in
+ * the background and swaps it in, so requests are never dropped or blocked by a reload
+ */
+class server {
+public:
+	server(const std::string& args) : args(unsaved(args)), current(std::make_shared<player>(this->args)),
+		stop(false), requests(0), batches(0) {}
+
+	/**
+	 * serve the endpoint, which is stdin/stdout if empty, until the input is closed
+	 */
+	void run(const std::string& endpoint) {
+		std::thread evaluator(&server::evaluate, this);
+		std::thread reloader(&server::reload, this);
+		if (endpoint.empty()) {
+			session(fileno(stdin), fileno(stdout));
+		} else if (endpoint.find("unix:") == 0) {
+			listen(endpoint.substr(5));
+		} else {
+			std::cerr << "unknown endpoint " << endpoint << std::endl;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		ready.notify_all();
+		renew.notify_all();
+		evaluator.join();
+		reloader.join();
+		std::cerr << "served " << stats() << std::endl;
+	}
+
+protected:
+	struct request {
+		std::string line;
+		profiler::tick arrival;
+		std::promise<std::string> reply;
+	};
+
+	/**
+	 * read the requests of a connection, and write the replies in order
+	 */
+	void session(int in, int out) {
+		std::mutex order;
+		std::condition_variable more;
+		std::deque<std::future<std::string>> replies;
+		bool closed = false;
+		std::thread writer([&]() {
+			while (true) {
+				std::unique_lock<std::mutex> lock(order);
+				more.wait(lock, [&]() { return closed || replies.size(); });
+				if (replies.empty()) break;
+				std::future<std::string> reply = std::move(replies.front());
+				replies.pop_front();
+				lock.unlock();
+				std::string text = reply.get() + "\n";
+				if (!write(out, text)) break;
+			}
+		});
+		std::string buffer;
+		char chunk[4096];
+		for (ssize_t n; (n = ::read(in, chunk, sizeof(chunk))) > 0; ) {
+			buffer.append(chunk, n);
+			size_t begin = 0;
+			for (size_t end; (end = buffer.find('\n', begin)) != std::string::npos; begin = end + 1) {
+				std::string line = buffer.substr(begin, end - begin);
+				if (line.size() && line.back() == '\r') line.pop_back();
+				if (line.empty()) continue;
+				std::future<std::string> reply = submit(line);
+				std::lock_guard<std::mutex> lock(order);
+				replies.push_back(std::move(reply));
+				more.notify_one();
+			}
+			buffer.erase(0, begin);
+		}
+		{
+			std::lock_guard<std::mutex> lock(order);
+			closed = true;
+		}
+		more.notify_one();
+		writer.join();
+	}
+
+	void listen(const std::string& path) {
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		::unlink(path.c_str());
+		if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+			std::cerr << "cannot listen on " << path << std::endl;
+			return;
+		}
+		for (int conn; (conn = ::accept(fd, nullptr, nullptr)) >= 0; ) {
+			std::thread([this, conn]() {
+				session(conn, conn);
+				::close(conn);
+			}).detach();
+		}
+		::close(fd);
+	}
+
+	/**
+	 * queue a request for the evaluator, or for the reloader if it is a reload
+	 */
+	std::future<std::string> submit(const std::string& line) {
+		request* req = new request{ line, profiler::nanosec(), {} };
+		std::future<std::string> reply = req->reply.get_future();
+		bool reloading = line.find("reload") == 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (reloading) reloads.push_back(req);
+			else pending.push_back(req);
+		}
+		(reloading ? renew : ready).notify_one();
+		return reply;
+	}
+
+	/**
+	 * take all the pending requests as a batch, and answer them with one network
+	 */
+	void evaluate() {
+		std::vector<request*> batch;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				ready.wait(lock, [&]() { return stop || pending.size(); });
+				if (pending.empty()) break;
+				std::swap(batch, pending);
+			}
+			std::shared_ptr<player> play = std::atomic_load(&current);
+			for (request* req : batch) {
+				req->reply.set_value(answer(*play, req->line));
+				record(profiler::nanosec() - req->arrival);
+				delete req;
+			}
+			batches++;
+			batch.clear();
+		}
+	}
+
+	std::string answer(const player& play, const std::string& line) {
+		std::stringstream in(line);
+		std::string command;
+		if (!std::isdigit(line[0])) in >> command;
+		if (command == "stats") return stats();
+		board state;
+		if (!(in >> state)) return "error";
+		std::stringstream out;
+		if (command.empty() || command == "move") {
+			player::step best;
+			int op = play.select_action(state, best);
+			out << op << " " << (op != -1 ? best.reward : 0) << " " << (op != -1 ? play.estimate_value(best.after) : 0);
+		} else if (command == "value") {
+			out << play.estimate_value(state);
+		} else {
+			return "error";
+		}
+		return out.str();
+	}
+
+	/**
+	 * load the weights of each reload in turn, and swap them in when ready
+	 * the requests in the meantime are answered with the old weights
+	 */
+	void reload() {
+		while (true) {
+			request* req;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				renew.wait(lock, [&]() { return stop || reloads.size(); });
+				if (reloads.empty()) break;
+				req = reloads.front();
+				reloads.pop_front();
+			}
+			std::stringstream in(req->line);
+			std::string command, path;
+			in >> command >> path;
+			if (path.size() && verify(path, *std::atomic_load(&current))) {
+				std::shared_ptr<player> next = std::make_shared<player>(args + " load=" + path);
+				std::atomic_store(&current, next);
+				req->reply.set_value("ok");
+			} else {
+				req->reply.set_value("error");
+			}
+			delete req;
+		}
+	}
+
+	/**
+	 * whether 'path' can be loaded by a player of the same tables as 'play', i.e., it has the
+	 * same tables of the same sizes, is not truncated, and matches its checksums if it has them
+	 * a player exits on a broken file, which must not happen to a server
+	 */
+	static bool verify(const std::string& path, const player& play) {
+		weightio::reader in(path);
+		const std::vector<weight>& net = play.weights();
+		const std::vector<std::vector<unsigned>>& tuples = play.tuple_set();
+		if (!in.good() || in.tables().size() != net.size()) return false;
+		for (size_t t = 0; t < net.size(); t++) {
+			size_t len = in.tables()[t];
+			if (len != net[t].size() && len != size_t(std::pow(25, tuples[t].size()))) return false;
+			weight w;
+			if (!in.get(t, w)) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * the arguments without 'save=', since a player saves its weights when it is released,
+	 * which would overwrite the file with the network that a reload just replaced
+	 */
+	static std::string unsaved(const std::string& args) {
+		std::stringstream in(args);
+		std::string out;
+		for (std::string pair; in >> pair; ) {
+			if (pair.find("save=") != 0) out += (out.size() ? " " : "") + pair;
+		}
+		return out;
+	}
+
+	void record(profiler::tick latency) {
+		std::lock_guard<std::mutex> lock(timing);
+		if (latencies.size() < window) latencies.push_back(latency);
+		else latencies[requests % window] = latency;
+		requests++;
+	}
+
+	std::string stats() {
+		std::vector<profiler::tick> sample;
+		size_t n;
+		{
+			std::lock_guard<std::mutex> lock(timing);
+			sample = latencies;
+			n = requests;
+		}
+		std::sort(sample.begin(), sample.end());
+		auto percentile = [&](double p) {
+			return sample.size() ? sample[std::min(size_t(p * sample.size()), sample.size() - 1)] * 1e-3 : 0;
+		};
+		std::stringstream out;
+		out << std::fixed << std::setprecision(1);
+		out << "n " << n << " batch " << (batches ? double(n) / batches : 0);
+		out << " p50 " << percentile(0.5) << " p99 " << percentile(0.99) << " max " << percentile(1);
+		return out.str();
+	}
+
+	static bool write(int fd, const std::string& text) {
+		const char* buf = text.data();
+		for (size_t size = text.size(); size; ) {
+			ssize_t n = ::write(fd, buf, size);
+			if (n <= 0) return false;
+			buf += n;
+			size -= n;
+		}
+		return true;
+	}
+
+private:
+	static constexpr size_t window = 100000; // the latencies of the latest requests
+	std::string args;
+	std::shared_ptr<player> current;
+
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable renew;
+	std::vector<request*> pending;
+	std::deque<request*> reloads;
+	bool stop;
+
+	std::mutex timing;
+	std::vector<profiler::tick> latencies;
+	size_t requests;
+	std::atomic<size_t> batches;
+};
@@ -0,0 +1,276 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * shard.h: Sharded training by several processes through a shared directory
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "agent.h"
+#include "weight.h"
+#include "statistic.h"
+#include "checkpoint.h"
+#include "profiler.h"
+
+/**
+ * one of 'workers' training processes which share the weights through a directory
+ *
+ * the processes train on their own environments, and synchronize every 'sync' episodes:
+ * each writes the blocks it changed since the base as 'dir/delta.<generation>.<worker>',
+ * in the delta format of checkpoint.h with serial = generation and sequence = worker, and
+ * a trailer of its TD updates in the round; worker 0 then merges the deltas into the next
+ * base, and the others wait for it and reload it in place
+ *
+ * a merged block is the average of the block in the deltas that changed it, weighted by
+ * their TD updates, and a block changed by none is kept; the base is 'dir/base' with the
+ * trailer "<generation>\n", and 'dir/generation' is rewritten after the base is renamed,
+ * so a worker never reads a partial base
+ *
+ * the dirty marks of the tables are taken by the synchronization, so delta checkpoints
+ * cannot be used by a sharded run
+ */
+class shard {
+public:
+	shard(const std::string& dir, size_t workers, size_t worker, size_t sync)
+		: dir(dir), workers(std::max(workers, size_t(1))), worker(worker), sync(sync),
+		  generation(0), last_count(0), updates(0), elapsed(0), merging(0), written(0) {
+		if (worker >= this->workers) {
+			std::cerr << "worker " << worker << " is out of " << workers << " workers" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * take the current base, or let worker 0 publish the weights of the player as the first one
+	 */
+	void start(player& play, const statistic& stat) {
+		::mkdir(dir.c_str(), 0755);
+		last_count = stat.episodes();
+		if (worker == 0 && !published(generation)) {
+			if (!publish(play.weights(), 0)) std::exit(-1);
+		}
+		while (!published(generation)) idle();
+		if (!load(dir + "/base", play.weights(), generation)) {
+			std::cerr << "cannot load " << dir << "/base" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * count the TD updates of the last episode, and synchronize every 'sync' episodes
+	 * this is a watcher of the statistic, so the last episode is already learned and
+	 * the delta of a round holds all its episodes (see statistic::settle_episode)
+	 */
+	void tick(player& play, statistic& stat) {
+		updates += stat.back().step(action::slide::type);
+		if (sync && stat.episodes() - last_count >= sync) synchronize(play, stat);
+	}
+
+	/**
+	 * write the delta of this round, and continue with the next base once it is published
+	 */
+	void synchronize(player& play, const statistic& stat) {
+		profiler::tick start = profiler::nanosec();
+		last_count = stat.episodes();
+		std::vector<weight>& net = play.weights();
+		std::vector<std::vector<uint8_t>> marks;
+		for (weight& w : net) marks.push_back(w.collect());
+		std::string target = delta(generation, worker), temp = target + ".tmp";
+		if (!checkpoint::write(temp, net, marks, generation, worker, std::to_string(updates) + "\n")
+				|| std::rename(temp.c_str(), target.c_str()) != 0) {
+			std::cerr << "cannot write " << target << std::endl;
+			std::exit(-1);
+		}
+		struct stat info;
+		written = ::stat(target.c_str(), &info) == 0 ? info.st_size : 0;
+		updates = 0;
+
+		if (worker == 0) {
+			for (size_t k = 0; k < workers; k++) {
+				while (::access(delta(generation, k).c_str(), R_OK) != 0) idle();
+			}
+			profiler::tick begin = profiler::nanosec();
+			if (!load(dir + "/base", net, generation) || !merge(net, generation) || !publish(net, generation + 1)) {
+				std::cerr << "cannot merge generation " << generation << " in " << dir << std::endl;
+				std::exit(-1);
+			}
+			for (weight& w : net) w.collect(); // the merged base is not a change of this worker
+			for (size_t k = 0; k < workers; k++) ::unlink(delta(generation, k).c_str());
+			merging = profiler::nanosec() - begin;
+			generation++;
+		} else {
+			uint64_t next = generation + 1;
+			while (!published(next)) idle();
+			if (!load(dir + "/base", net, generation) || generation < next) {
+				std::cerr << "cannot load " << dir << "/base" << std::endl;
+				std::exit(-1);
+			}
+		}
+		elapsed = profiler::nanosec() - start;
+	}
+
+	/**
+	 * merge the deltas of a generation into the tables, which hold the base of the generation
+	 */
+	bool merge(std::vector<weight>& net, uint64_t generation) const {
+		std::vector<std::vector<double>> total(net.size()); // the TD updates of the deltas changing each block
+		std::vector<double> count(workers);
+		for (size_t t = 0; t < net.size(); t++) total[t].assign(net[t].blocks(), 0);
+		for (size_t k = 0; k < workers; k++) {
+			if (!read(delta(generation, k), net, generation, k, count[k], [&](size_t t, size_t b, const weight::type*) {
+				total[t][b] += std::max(count[k], 1.0);
+			})) return false;
+		}
+		std::vector<std::vector<uint8_t>> fresh(net.size()); // whether a block still holds the base
+		for (size_t t = 0; t < net.size(); t++) fresh[t].assign(net[t].blocks(), 1);
+		for (size_t k = 0; k < workers; k++) {
+			double n = 0;
+			if (!read(delta(generation, k), net, generation, k, n, [&](size_t t, size_t b, const weight::type* v) {
+				weight& w = net[t];
+				size_t first = b * weight::block, last = std::min(first + weight::block, w.size());
+				float share = std::max(count[k], 1.0) / total[t][b];
+				if (fresh[t][b]) std::fill(&w[first], &w[first] + (last - first), 0);
+				for (size_t i = first; i < last; i++) w[i] += share * v[i - first];
+				fresh[t][b] = 0;
+			})) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * the format would be
+	 * shard = worker 1/4, generation 12, last sync 0.8s (merge 0.5s), 4.1MB delta
+	 *
+	 * where 'last sync' is the time from writing the delta to training on the next base,
+	 * and 'merge' is the time of worker 0 to merge the deltas
+	 */
+	void report(std::ostream& out) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "\t" "shard = worker " << worker << "/" << workers << ", generation " << generation;
+		out << ", last sync " << std::fixed << std::setprecision(1) << (elapsed * 1e-9) << "s";
+		if (worker == 0) out << " (merge " << (merging * 1e-9) << "s)";
+		out << ", " << (written * 1e-6) << "MB delta" << std::endl;
+		out.copyfmt(ff);
+	}
+
+protected:
+	std::string delta(uint64_t generation, size_t k) const {
+		return dir + "/delta." + std::to_string(generation) + "." + std::to_string(k);
+	}
+
+	/**
+	 * whether the base of the given generation (or a later one) is published
+	 */
+	bool published(uint64_t generation) const {
+		std::ifstream in(dir + "/generation");
+		uint64_t current = 0;
+		return (in >> current) && current >= generation;
+	}
+
+	bool publish(const std::vector<weight>& net, uint64_t generation) const {
+		std::string base = dir + "/base", mark = dir + "/generation";
+		std::string trailer = std::to_string(generation) + "\n";
+		if (!checkpoint::write(base + ".tmp", net, trailer) || std::rename((base + ".tmp").c_str(), base.c_str()) != 0) {
+			std::cerr << "cannot write " << base << std::endl;
+			return false;
+		}
+		std::ofstream out(mark + ".tmp", std::ios::out | std::ios::trunc);
+		out << trailer;
+		out.close();
+		return out && std::rename((mark + ".tmp").c_str(), mark.c_str()) == 0;
+	}
+
+	/**
+	 * read a base into the tables in place, and take its generation
+	 */
+	static bool load(const std::string& path, std::vector<weight>& net, uint64_t& generation) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		uint32_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		if (!in || size != net.size()) return false;
+		for (weight& w : net) {
+			size_t len = w.size();
+			in >> w;
+			if (w.size() != len) return false;
+		}
+		std::string trailer;
+		return checkpoint::read_trailer(in, trailer) && (std::stringstream(trailer) >> generation);
+	}
+
+	/**
+	 * read a delta of the given generation and worker, and pass each of its blocks to 'apply'
+	 * with the table, the block and the values; its TD updates are stored into 'count'
+	 */
+	template<typename callback>
+	static bool read(const std::string& path, const std::vector<weight>& net, uint64_t generation, size_t k,
+			double& count, callback apply) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		char magic[4] = {};
+		uint64_t head[2] = {};
+		uint32_t size = 0;
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(head), sizeof(head));
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		if (!in || std::string(magic, 4) != "wdlt" || head[0] != generation || head[1] != k || size != net.size()) return false;
+		std::vector<weight::type> values;
+		std::streampos data = in.tellg();
+		for (int pass = 0; pass < 2; pass++) { // the first pass takes the trailer, which is at the end
+			in.clear();
+			in.seekg(data);
+			for (size_t t = 0; t < net.size(); t++) {
+				uint64_t len = 0, runs = 0;
+				in.read(reinterpret_cast<char*>(&len), sizeof(len));
+				in.read(reinterpret_cast<char*>(&runs), sizeof(runs));
+				if (!in || len != net[t].size()) return false;
+				for (uint64_t r = 0; r < runs; r++) {
+					uint64_t run[2] = {};
+					in.read(reinterpret_cast<char*>(run), sizeof(run));
+					size_t first = run[0] * weight::block, last = std::min((run[0] + run[1]) * weight::block, len);
+					if (!in || first >= last) return false;
+					if (pass == 0) {
+						in.seekg((last - first) * sizeof(weight::type), std::ios::cur);
+						continue;
+					}
+					values.resize(last - first);
+					in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(weight::type));
+					if (!in) return false;
+					for (uint64_t b = 0; b < run[1]; b++) apply(t, run[0] + b, &values[b * weight::block]);
+				}
+			}
+			std::string trailer;
+			if (pass == 0 && !(checkpoint::read_trailer(in, trailer) && (std::stringstream(trailer) >> count))) return false;
+		}
+		return true;
+	}
+
+	static void idle() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+private:
+	std::string dir;
+	size_t workers;
+	size_t worker;
+	size_t sync;
+	uint64_t generation;
+	size_t last_count;
+	size_t updates;
+	profiler::tick elapsed;
+	profiler::tick merging;
+	size_t written;
+};
@@ -8,16 +8,23 @@
  */
 
 #pragma once
-#include <list>
+#include <vector>
+#include <array>
+#include <numeric>
+#include <iomanip>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <functional>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
+#include "profiler.h"
 
 class statistic {
+friend class checkpoint;
+friend class logfile;
 public:
 	/**
 	 * the total episodes to run
@@ -30,7 +37,9 @@ public:
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0), head(0), blank(0) {
+		data.reserve(std::min(this->limit, total)); // the ring never moves its episodes
+	}
 
 public:
 	/**
@@ -44,6 +53,8 @@ public:
 	 *        4096    98.4%  (4.7%)
 	 *        8192    93.7%  (22.4%)
 	 *        16384   71.3%  (71.3%)
+	 *        phase = slide 35ns (4.1%), feature 96ns (22.5%), lookup 240ns (56.3%), ...
+	 *        perf = llc-miss/dtlb-miss/br-miss per call: slide 0.0/0.0/2.1, ...
 	 *
 	 * where (block = 1000 by default)
 	 *  '1000': current index (n)
@@ -54,50 +65,92 @@ public:
 	 *                                  the average speed of environment is 896715
 	 *  '93.7%': 93.7% (937 games) reached 8192-tiles (a.k.a. win rate of 8192-tile)
 	 *  '22.4%': 22.4% (224 games) terminated with 8192-tiles (the largest)
+	 *  'phase = ...': the average time of each profiler phase since the last report,
+	 *                 and its share of the total time, with '--profile' only (see profiler.h)
+	 *  'perf = ...': the hardware events of each phase per call, with '--perf' only
 	 */
 	void show(bool tstat = true) const {
-		size_t blk = std::min(data.size(), block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::reward sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < blk; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(&(ep.state()(0)), &(ep.state()(16)))]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
+		print(collect(), tstat);
+	}
+
+	/**
+	 * the statistic of the last 'block' games, as shown by show()
+	 */
+	struct record {
+		size_t count; // the current index
+		size_t games; // the games in the block
+		board::reward sum;
+		board::reward max;
+		size_t sop, pop, eop; // the steps of all, of the player, and of the environment
+		time_t sdu, pdu, edu; // their durations
+		size_t boards; // the games whose boards are kept, over which the tiles are counted
+		std::array<size_t, 64> ending; // the games terminated with each tile
+		profiler::report phase; // the profiler phases since the last record
+
+		double avg() const { return games ? double(sum) / games : 0; }
+		double ops() const { return sop * 1000.0 / sdu; }
+		double player_ops() const { return pop * 1e9 / pdu; }
+		double env_ops() const { return eop * 1e9 / edu; }
+		size_t reach(unsigned t) const { return std::accumulate(ending.begin() + t, ending.end(), size_t(0)); }
+	};
+
+	/**
+	 * summarize the last 'block' games, and mark the profiler phases as reported
+	 */
+	record collect() const {
+		record r = {};
+		r.count = count;
+		r.games = std::min(data.size(), block);
+		for (size_t i = data.size() - r.games; i < data.size(); i++) {
+			auto& ep = at(i);
+			r.sum += ep.score();
+			r.max = std::max(ep.score(), r.max);
+			if (count - data.size() + i >= blank) {
+				r.ending[*std::max_element(&(ep.state()(0)), &(ep.state()(16)))]++;
+				r.boards++;
+			}
+			r.sop += ep.step();
+			r.pop += ep.step(action::slide::type);
+			r.eop += ep.step(action::place::type);
+			r.sdu += ep.time();
+			r.pdu += ep.time(action::slide::type);
+			r.edu += ep.time(action::place::type);
 		}
+		profiler::report phase = profiler::collect();
+		r.phase = phase - mark;
+		mark = phase;
+		return r;
+	}
 
+	void print(const record& r, bool tstat = true) const {
+		size_t blk = r.games;
 		std::ios ff(nullptr);
 		ff.copyfmt(std::cout);
 		std::cout << std::fixed << std::setprecision(0);
-		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / blk) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
+		std::cout << r.count << "\t";
+		std::cout << "avg = " << (r.sum / blk) << ", ";
+		std::cout << "max = " << (r.max) << ", ";
+		std::cout << "ops = " << r.ops();
+		std::cout <<     " (" << r.player_ops();
+		std::cout <<      "|" << r.env_ops() << ")";
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
 
-		
-
 		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			unsigned accu = std::accumulate(std::begin(stat) + t, std::end(stat), 0);
+		for (size_t t = 0, c = 0; c < r.boards; c += r.ending[t++]) {
+			if (r.ending[t] == 0) continue;
 			std::cout << "\t" << board::fibonacci(t); // type
-			std::cout << "\t" << (accu * 100.0 / blk) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / blk) << "%" ")"; // percentage of ending
+			std::cout << "\t" << (r.reach(t) * 100.0 / r.boards) << "%"; // win rate
+			std::cout << "\t" "(" << (r.ending[t] * 100.0 / r.boards) << "%" ")"; // percentage of ending
+			std::cout << std::endl;
+		}
+		if (r.phase.total()) std::cout << "\t" << r.phase << std::endl;
+		if (r.phase.total() && profiler::available().size()) {
+			std::cout << "\t";
+			r.phase.print_events(std::cout);
 			std::cout << std::endl;
 		}
+		for (auto& report : reports) report(std::cout);
 		std::cout << std::endl;
 	}
 
@@ -112,34 +165,106 @@ public:
 		return count >= total;
 	}
 
+	/**
+	 * the records are kept in a ring of at most 'limit' slots
+	 * once the ring is full, the oldest slot is recycled in place
+	 */
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
-		data.back().open_episode(flag);
+		if (count++ >= limit && data.size()) {
+			data[head].clear();
+			head = (head + 1) % data.size();
+		} else {
+			data.emplace_back();
+		}
+		back().open_episode(flag);
 	}
 
+	/**
+	 * close the last episode, and show the block statistics if the block is complete
+	 * the watchers are called by settle_episode, once the agents have closed it as well
+	 */
 	void close_episode(const std::string& flag = "") {
-		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		back().close_episode(flag);
+		if (count % block == 0) flush();
+	}
+
+	/**
+	 * call the watchers on the last episode, whose updates are then in the weights
+	 */
+	void settle_episode() {
+		for (auto& callback : watchers) callback();
+	}
+
+	/**
+	 * record a finished episode, e.g., one played by another thread
+	 * the episode is swapped with a recycled slot, so the caller gets an empty one back
+	 */
+	void push(episode& ep) {
+		open_episode();
+		std::swap(back(), ep);
+		if (count % block == 0) flush();
+		settle_episode();
+	}
+
+	/**
+	 * append an extra report to the block statistics
+	 * the report should print its own lines, each led by a tab
+	 */
+	void attach(const std::function<void(std::ostream&)>& report) {
+		reports.push_back(report);
+	}
+
+	/**
+	 * pass the record of every block to 'sink', after it is shown
+	 */
+	void export_to(const std::function<void(const record&)>& sink) {
+		sinks.push_back(sink);
+	}
+
+	/**
+	 * call back after every recorded episode (and its block report, if any) is learned
+	 */
+	void watch(const std::function<void()>& callback) {
+		watchers.push_back(callback);
+	}
+
+	size_t remaining() const {
+		return total > count ? total - count : 0;
+	}
+	size_t episodes() const {
+		return count;
+	}
+	size_t block_size() const {
+		return block;
+	}
+
+	/**
+	 * end the run with the recorded episodes, e.g., once a sequential test has decided
+	 */
+	void stop() {
+		total = count;
 	}
 
 	episode& at(size_t i) {
-		auto it = data.begin();
-		while (i--) it++;
-		return *it;
+		return data[(head + i) % data.size()];
+	}
+	const episode& at(size_t i) const {
+		return data[(head + i) % data.size()];
 	}
 	episode& front() {
-		return data.front();
+		return at(0);
 	}
 	episode& back() {
-		return data.back();
+		return at(data.size() - 1);
 	}
 
 	friend std::ostream& operator <<(std::ostream& out, const statistic& stat) {
-		for (const episode& rec : stat.data) out << rec << std::endl;
+		for (size_t i = 0; i < stat.data.size(); i++) out << stat.at(i) << std::endl;
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, statistic& stat) {
+		std::rotate(stat.data.begin(), stat.data.begin() + stat.head, stat.data.end());
+		stat.head = 0;
 		for (std::string line; std::getline(in, line) && line.size(); ) {
 			stat.data.emplace_back();
 			std::stringstream(line) >> stat.data.back();
@@ -149,10 +274,23 @@ public:
 		return in;
 	}
 
+private:
+	void flush() {
+		record r = collect();
+		print(r);
+		for (auto& sink : sinks) sink(r);
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
-	std::list<episode> data;
+	size_t head;
+	size_t blank; // the first episodes, which are loaded without their boards (see logfile)
+	std::vector<episode> data;
+	mutable profiler::report mark;
+	std::vector<std::function<void(std::ostream&)>> reports;
+	std::vector<std::function<void()>> watchers;
+	std::vector<std::function<void(const record&)>> sinks;
 };
@@ -11,22 +11,53 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <cstdint>
 
+/**
+ * a lookup table with dirty tracking
+ *
+ * the table is divided into blocks of 'block' entries (4 KB of floats); a block is marked
+ * dirty when it is written through the non-const operator[] or add(), and the marks are
+ * collected by checkpoints to write only the changed blocks
+ */
 class weight {
 public:
 	typedef float type;
+	static constexpr size_t block = 1024;
 
 public:
 	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
+	weight(size_t len) : value(len), dirty((len + block - 1) / block) {}
+	weight(weight&& f) : value(std::move(f.value)), dirty(std::move(f.dirty)) {}
 	weight(const weight& f) = default;
 
 	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
+	weight& operator =(weight&& f) = default;
+	type& operator[] (size_t i) { dirty[i / block] = 1; return value[i]; }
 	const type& operator[] (size_t i) const { return value[i]; }
 	size_t size() const { return value.size(); }
 
+	/**
+	 * add to an entry, and mark its block after the write
+	 * so that a concurrent checkpoint never clears a mark of a write it did not capture
+	 */
+	void add(size_t i, type v) {
+		value[i] += v;
+		__atomic_store_n(&dirty[i / block], 1, __ATOMIC_RELEASE);
+	}
+
+	size_t blocks() const { return dirty.size(); }
+	bool is_dirty(size_t b) const { return dirty[b]; }
+
+	/**
+	 * take and clear the dirty marks
+	 */
+	std::vector<uint8_t> collect() {
+		std::vector<uint8_t> marks(dirty.size());
+		for (size_t b = 0; b < dirty.size(); b++) marks[b] = __atomic_exchange_n(&dirty[b], 0, __ATOMIC_ACQUIRE);
+		return marks;
+	}
+
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
 		auto& value = w.value;
@@ -40,10 +71,12 @@ public:
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
 		value.resize(size);
+		w.dirty.assign((size + block - 1) / block, 0);
 		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
 		return in;
 	}
 
 protected:
 	std::vector<type> value;
+	std::vector<uint8_t> dirty;
 };
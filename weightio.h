@@ -0,0 +1,293 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * weightio.h: Parallel chunked I/O of the weight files
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include "weight.h"
+
+/**
+ * the weight file, i.e., uint32 tables, then for each table uint64 size | size x float,
+ * read and written by table, where each table is split into chunks of 'chunk' bytes
+ * which are transferred by several threads with pread and pwrite
+ *
+ * a written file is followed by a trailer of the chunk checksums
+ * "wsum" | uint64 chunk | uint64 count | count x uint64 checksum,
+ * which is ignored by the other readers; a file without it (e.g., a checkpoint) is read
+ * without verification. a file is written to 'path.tmp', which is allocated in advance
+ * and renamed to 'path' when complete
+ *
+ * the transfers go through the page cache; O_DIRECT is not used, since the tables of the
+ * format start at offsets which are not aligned to the blocks of the device
+ */
+class weightio {
+public:
+	static constexpr size_t default_chunk = 4 << 20;
+
+protected:
+	/**
+	 * a set of threads which run the chunks of one table after another,
+	 * so that the threads are started once for a whole file
+	 */
+	class pool {
+	public:
+		pool(size_t threads) : job(nullptr), count(0), next(0), ok(true), busy(0), round(0), stop(false) {
+			for (size_t i = 1; i < threads; i++) crew.emplace_back(&pool::work, this);
+		}
+		~pool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			wake.notify_all();
+			for (std::thread& t : crew) t.join();
+		}
+
+		/**
+		 * call 'job' for [0, count) by all the threads including the calling one,
+		 * and return whether all of them succeed
+		 */
+		bool run(size_t count, const std::function<bool(size_t)>& job) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				this->job = &job;
+				this->count = count;
+				next = 0;
+				ok = true;
+				busy = crew.size();
+				round++;
+			}
+			wake.notify_all();
+			drain();
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return busy == 0; });
+			return ok;
+		}
+
+	private:
+		void drain() {
+			for (size_t k; (k = next.fetch_add(1)) < count; ) {
+				if (!(*job)(k)) ok = false;
+			}
+		}
+		void work() {
+			for (size_t seen = 0; ; ) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stop || round != seen; });
+					if (stop) return;
+					seen = round;
+				}
+				drain();
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busy == 0) idle.notify_one();
+			}
+		}
+
+		std::vector<std::thread> crew;
+		const std::function<bool(size_t)>* job;
+		size_t count;
+		std::atomic<size_t> next;
+		std::atomic<bool> ok;
+		size_t busy; // the threads of the crew still in this round
+		size_t round;
+		bool stop;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable idle;
+	};
+
+public:
+
+	/**
+	 * create a file of the given table sizes; the tables are then written by put
+	 */
+	class writer {
+	public:
+		writer(const std::string& path, const std::vector<size_t>& sizes, size_t threads = 0, size_t chunk = default_chunk)
+			: path(path), sizes(sizes), chunk(align(chunk)), crew(workers(threads)), fd(-1), ok(true) {
+			offset.push_back(sizeof(uint32_t));
+			for (size_t len : sizes) offset.push_back(offset.back() + sizeof(uint64_t) + len * sizeof(weight::type));
+			for (size_t len : sizes) first.push_back(sums.size()), sums.resize(sums.size() + pieces(len, this->chunk));
+			fd = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			ok = fd >= 0;
+			if (ok) ::posix_fallocate(fd, 0, offset.back() + 20 + sums.size() * sizeof(uint64_t)); // a hint, may be unsupported
+			uint32_t count = sizes.size();
+			ok = ok && put(&count, sizeof(count), 0);
+		}
+		~writer() {
+			if (fd >= 0) ::close(fd);
+		}
+
+		/**
+		 * write table t, which should have the size given to the constructor
+		 */
+		bool put(size_t t, const weight& w) {
+			uint64_t len = w.size();
+			ok = ok && len == sizes[t] && put(&len, sizeof(len), offset[t]);
+			if (!ok || len == 0) return ok;
+			const char* data = reinterpret_cast<const char*>(&w[0]);
+			size_t bytes = len * sizeof(weight::type), base = offset[t] + sizeof(uint64_t);
+			ok = crew.run(pieces(len, chunk), [&](size_t k) {
+				size_t from = k * chunk, size = std::min(chunk, bytes - from);
+				sums[first[t] + k] = checksum(data + from, size);
+				return put(data + from, size, base + from);
+			});
+			return ok;
+		}
+
+		/**
+		 * write the trailer, and rename the file to the path
+		 */
+		bool close() {
+			uint64_t head[2] = { chunk, sums.size() };
+			ok = ok && put("wsum", 4, offset.back()) && put(head, sizeof(head), offset.back() + 4);
+			ok = ok && (sums.empty() || put(sums.data(), sums.size() * sizeof(uint64_t), offset.back() + 20));
+			ok = ::close(fd) == 0 && ok;
+			fd = -1;
+			return ok && std::rename((path + ".tmp").c_str(), path.c_str()) == 0;
+		}
+
+	protected:
+		bool put(const void* data, size_t size, size_t at) {
+			const char* buf = static_cast<const char*>(data);
+			while (size) {
+				ssize_t n = ::pwrite(fd, buf, size, at);
+				if (n <= 0) return false;
+				buf += n, at += n, size -= n;
+			}
+			return true;
+		}
+
+	private:
+		std::string path;
+		std::vector<size_t> sizes;
+		size_t chunk;
+		pool crew;
+		int fd;
+		bool ok;
+		std::vector<size_t> offset; // the offset of each table, and of the trailer at the end
+		std::vector<size_t> first; // the first chunk of each table
+		std::vector<uint64_t> sums;
+	};
+
+	/**
+	 * open a file and take its table sizes; the tables are then read by get
+	 */
+	class reader {
+	public:
+		reader(const std::string& path, size_t threads = 0) : crew(workers(threads)), chunk(0), fd(-1), ok(true) {
+			fd = ::open(path.c_str(), O_RDONLY);
+			uint32_t count = 0;
+			ok = fd >= 0 && get(&count, sizeof(count), 0);
+			offset.push_back(sizeof(uint32_t));
+			for (uint32_t t = 0; ok && t < count; t++) {
+				uint64_t len = 0;
+				ok = get(&len, sizeof(len), offset.back());
+				sizes.push_back(len);
+				offset.push_back(offset.back() + sizeof(uint64_t) + len * sizeof(weight::type));
+			}
+			char magic[4] = {};
+			uint64_t head[2] = {};
+			if (ok && get(magic, 4, offset.back()) && std::string(magic, 4) == "wsum" && get(head, sizeof(head), offset.back() + 4)) {
+				chunk = head[0];
+				sums.resize(head[1]);
+				size_t total = 0;
+				for (size_t len : sizes) first.push_back(total), total += pieces(len, chunk);
+				ok = chunk && chunk % sizeof(weight::type) == 0 && total == sums.size();
+				ok = ok && (sums.empty() || get(sums.data(), sums.size() * sizeof(uint64_t), offset.back() + 20));
+			}
+		}
+		~reader() {
+			if (fd >= 0) ::close(fd);
+		}
+
+		bool good() const { return ok; }
+		bool verified() const { return chunk != 0; }
+		const std::vector<size_t>& tables() const { return sizes; }
+
+		/**
+		 * read table t into 'w', and verify its checksums if the file has them
+		 */
+		bool get(size_t t, weight& w) {
+			if (!ok) return false;
+			w = weight(sizes[t]);
+			if (sizes[t] == 0) return true;
+			char* data = reinterpret_cast<char*>(&w[0]);
+			size_t bytes = sizes[t] * sizeof(weight::type), base = offset[t] + sizeof(uint64_t);
+			size_t size = chunk ? chunk : align(default_chunk);
+			ok = crew.run(pieces(sizes[t], size), [&](size_t k) {
+				size_t from = k * size, n = std::min(size, bytes - from);
+				return get(data + from, n, base + from) && (!chunk || checksum(data + from, n) == sums[first[t] + k]);
+			});
+			w.collect(); // loaded entries are not changes
+			return ok;
+		}
+
+	protected:
+		bool get(void* data, size_t size, size_t at) {
+			char* buf = static_cast<char*>(data);
+			while (size) {
+				ssize_t n = ::pread(fd, buf, size, at);
+				if (n <= 0) return false;
+				buf += n, at += n, size -= n;
+			}
+			return true;
+		}
+
+	private:
+		pool crew;
+		size_t chunk;
+		int fd;
+		bool ok;
+		std::vector<size_t> sizes;
+		std::vector<size_t> offset;
+		std::vector<size_t> first;
+		std::vector<uint64_t> sums;
+	};
+
+	/**
+	 * a 64-bit checksum of 4 interleaved multiplicative hashes, so that it keeps up with the disk
+	 */
+	static uint64_t checksum(const char* data, size_t size) {
+		uint64_t h[4] = { 0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, size };
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			uint64_t w[4];
+			std::memcpy(w, data + i, 32);
+			for (int k = 0; k < 4; k++) h[k] = (h[k] ^ w[k]) * 0x100000001b3ull;
+		}
+		for (; i < size; i++) h[i % 4] = (h[i % 4] ^ uint8_t(data[i])) * 0x100000001b3ull;
+		uint64_t x = h[0] ^ (h[1] >> 7) ^ (h[2] << 11) ^ (h[3] >> 17);
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		return x ^ (x >> 31);
+	}
+
+protected:
+	static size_t workers(size_t threads) {
+		return threads ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	static size_t align(size_t chunk) { // a whole number of entries and pages
+		return std::max((chunk + 4095) / 4096 * 4096, size_t(4096));
+	}
+	static size_t pieces(size_t len, size_t chunk) {
+		return (len * sizeof(weight::type) + chunk - 1) / chunk;
+	}
+};
@@ -0,0 +1,102 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * wtool.cpp: Maintenance tool for weight files and checkpoints
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "weight.h"
+#include "checkpoint.h"
+#include "agent.h"
+
+/**
+ * read a full snapshot (or a plain weight file, with an empty trailer)
+ */
+bool load(const std::string& path, std::vector<weight>& net, std::string& trailer) {
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (!in.is_open()) return false;
+	uint32_t size = 0;
+	in.read(reinterpret_cast<char*>(&size), sizeof(size));
+	net.resize(size);
+	for (weight& w : net) in >> w;
+	if (!in) return false;
+	if (!checkpoint::read_trailer(in, trailer)) trailer.clear();
+	return true;
+}
+
+/**
+ * compact a chain of deltas into a full snapshot
+ * if no delta is given, the chain 'full.1', 'full.2', ... is applied until a link is missing
+ */
+int compact(const std::string& out, const std::string& full, std::vector<std::string> deltas) {
+	std::vector<weight> net;
+	std::string trailer;
+	if (!load(full, net, trailer)) {
+		std::cerr << "cannot load " << full << std::endl;
+		return -1;
+	}
+	size_t count = 0;
+	uint64_t serial = 0;
+	std::stringstream(trailer) >> count >> serial;
+	bool chain = deltas.empty();
+	for (uint64_t seq = 1; chain || seq <= deltas.size(); seq++) {
+		std::string path = chain ? full + "." + std::to_string(seq) : deltas[seq - 1];
+		if (!checkpoint::patch(path, net, serial, seq, trailer)) {
+			if (chain) break;
+			std::cerr << "cannot apply " << path << " as delta " << seq << " of " << full << std::endl;
+			return -1;
+		}
+		std::cout << "applied " << path << std::endl;
+	}
+	if (!checkpoint::write(out + ".tmp", net, trailer) || std::rename((out + ".tmp").c_str(), out.c_str()) != 0) {
+		std::cerr << "cannot write " << out << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * convert the weights of a tuple set ("0,1,2,3,4/..." or the default set if empty) into its
+ * canonical form, which is loaded by a player with 'canonical'
+ */
+int convert(const std::string& out, const std::string& in, const std::string& spec) {
+	std::vector<weight> net;
+	std::string trailer;
+	if (!load(in, net, trailer)) {
+		std::cerr << "cannot load " << in << std::endl;
+		return -1;
+	}
+	std::vector<std::vector<unsigned>> tuples = spec.size() ? player::parse_patterns(spec) : player::patterns();
+	if (net.size() != tuples.size()) {
+		std::cerr << in << " has " << net.size() << " tables for " << tuples.size() << " tuples" << std::endl;
+		return -1;
+	}
+	player::canonical merged = player::canonicalize(tuples);
+	merged.print(std::cout, player::make_features(tuples).size());
+	net = player::convert(net, merged);
+	if (!checkpoint::write(out + ".tmp", net, trailer) || std::rename((out + ".tmp").c_str(), out.c_str()) != 0) {
+		std::cerr << "cannot write " << out << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, const char* argv[]) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	if (args.size() >= 3 && args[0] == "compact") {
+		return compact(args[1], args[2], std::vector<std::string>(args.begin() + 3, args.end()));
+	}
+	if ((args.size() == 3 || args.size() == 4) && args[0] == "convert") {
+		return convert(args[1], args[2], args.size() == 4 ? args[3] : "");
+	}
+	std::cerr << "usage: wtool compact <out> <full> [delta]..." << std::endl;
+	std::cerr << "       wtool convert <out> <in> [tuple]" << std::endl;
+	return -1;
+}